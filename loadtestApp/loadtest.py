@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8; mode: python -*-
+
+##########################################################################
+#
+# Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+#
+# text file Device Support 0.0.0
+# and higher are distributed subject to a Software License Agreement found
+# in file LICENSE that is included with this distribution.
+#
+# Author: Shuei Yamada (shuei@post.kek.jp)
+#
+##########################################################################
+
+"""Load test of devTextFile on a full IOC.
+
+Generates a database of longin/ai/stringin/waveform/longout/ao records over
+several scan periods, and their files on a tmpfs directory. Then runs the
+devTextFileLoad IOC for a given duration, rewriting the input files in the
+meantime, and reports achieved rates, scan overruns, CPU and memory.
+
+    make BUILD_LOADTEST=YES
+    loadtestApp/loadtest.py --records 200 --duration 60
+"""
+
+import argparse
+import os
+import random
+import re
+import subprocess
+import sys
+import time
+
+TOP = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# record types and their files, one file per record
+INPUTS = ("longin", "ai", "stringin", "waveform")
+OUTPUTS = ("longout", "ao")
+
+
+def scan_name(period):
+    """Choice of menuScan, e.g. ".1 second"."""
+    return re.sub(r"^0\.", ".", "%g" % period) + " second"
+
+
+def list_name(period):
+    return "LT:TICK:%gS" % period
+
+
+def write_file(path, text):
+    """Replace the file at once, so that the IOC never reads it half-written."""
+    tmp = path + ".tmp"
+    with open(tmp, "w") as f:
+        f.write(text)
+    os.replace(tmp, path)
+
+
+def contents(rtype, ftvl, nelm, rng):
+    if rtype == "longin":
+        return "%d\n" % rng.randrange(-100000, 100000)
+    if rtype == "ai":
+        return "%.6g\n" % rng.uniform(-1000, 1000)
+    if rtype == "stringin":
+        return "load test %d\n" % rng.randrange(1000000)
+    if ftvl in ("DOUBLE", "FLOAT"):
+        return "".join("%.6g\n" % rng.uniform(-1000, 1000) for _ in range(nelm))
+    return "".join("%d\n" % rng.randrange(-30000, 30000) for _ in range(nelm))
+
+
+def generate(args, rng):
+    """Write the database and files, returns list of input files with their type."""
+    datadir = os.path.join(args.dir, "data")
+    os.makedirs(datadir, exist_ok=True)
+
+    infos = [tag.split("=", 1) for tag in args.info]
+    files = []
+    db = []
+    for period in args.periods:
+        nrec = 0
+        for rtype in INPUTS + OUTPUTS:
+            for i in range(args.records):
+                ftvl = args.ftvl[i % len(args.ftvl)]
+                name = "LT:%gS:%s:%d" % (period, rtype.upper(), i)
+                path = os.path.join(datadir, "%g-%s-%d.txt" % (period, rtype, i))
+                missing = rtype in INPUTS and rng.random() < args.missing
+
+                lines = ['record(%s, "%s") {' % (rtype, name),
+                         '    field(SCAN, "%s")' % scan_name(period),
+                         '    field(DTYP, "Text File")']
+                if rtype in INPUTS:
+                    lines.append('    field(INP,  "@%s")' % path)
+                    if not missing:
+                        files.append((path, rtype, ftvl))
+                        write_file(path, contents(rtype, ftvl, args.nelm, rng))
+                    for tag, value in infos:
+                        lines.append('    info(%s, "%s")' % (tag, value))
+                else:
+                    lines.append('    field(OUT,  "@%s")' % path)
+                    lines.append('    field(VAL,  "%d")' % i)
+                if rtype == "waveform":
+                    lines.append('    field(NELM, "%d")' % args.nelm)
+                    lines.append('    field(FTVL, "%s")' % ftvl)
+                lines.append("}")
+                db.append("\n".join(lines))
+                nrec += 1
+
+        # processed after all records of the scan list, counts passes of the list
+        db.append("\n".join(['record(calc, "%s") {' % list_name(period),
+                             '    field(SCAN, "%s")' % scan_name(period),
+                             '    field(PHAS, "100")',
+                             '    field(CALC, "A+1")',
+                             '    field(INPA, "%s NPP")' % list_name(period),
+                             '    info(LoadTest:PERIOD, "%g")' % period,
+                             '    info(LoadTest:NREC, "%d")' % nrec,
+                             "}"]))
+
+    with open(os.path.join(args.dir, "loadtest.db"), "w") as f:
+        f.write("# generated by loadtest.py\n\n" + "\n\n".join(db) + "\n")
+
+    return files
+
+
+def startup(args):
+    dbior = os.path.join(args.dir, "dbior.txt")
+    lines = ["dbLoadDatabase %s" % os.path.join(TOP, "dbd", "devTextFileLoad.dbd"),
+             "devTextFileLoad_registerRecordDeviceDriver pdbbase",
+             "dbLoadRecords %s" % os.path.join(args.dir, "loadtest.db")]
+    lines += ["var %s" % var.replace("=", " ", 1) for var in args.var]
+    lines += ["iocInit",
+              "epicsThreadSleep %g" % args.warmup,
+              "devTextFileLoadStart",
+              "epicsThreadSleep %g" % args.duration,
+              "devTextFileLoadReport",
+              "dbior devTextFileAi 1 > %s" % dbior,
+              "exit"]
+
+    path = os.path.join(args.dir, "st.cmd")
+    with open(path, "w") as f:
+        f.write("\n".join(lines) + "\n")
+
+    return path
+
+
+def run(args, files, rng):
+    ioc = args.ioc or os.path.join(TOP, "bin", os.environ.get("EPICS_HOST_ARCH", "linux-x86_64"), "devTextFileLoad")
+    if not os.access(ioc, os.X_OK):
+        sys.exit("%s not found, build with 'make BUILD_LOADTEST=YES'" % ioc)
+
+    log = open(os.path.join(args.dir, "ioc.log"), "w+")
+    proc = subprocess.Popen([ioc, startup(args)], cwd=args.dir, stdin=subprocess.DEVNULL,
+                            stdout=log, stderr=subprocess.STDOUT)
+
+    # rewrite input files at the given period, as a writer would do
+    rewrites = 0
+    while proc.poll() is None:
+        time.sleep(args.update if args.update > 0 else 0.5)
+        if args.update > 0 and proc.poll() is None:
+            for path, rtype, ftvl in files:
+                write_file(path, contents(rtype, ftvl, args.nelm, rng))
+            rewrites += 1
+
+    log.seek(0)
+    output = log.read()
+    log.close()
+
+    match = re.search(r"^devTextFileLoadReport:.*?(?=^\S|\Z)", output, re.M | re.S)
+    if proc.returncode != 0 or match is None:
+        sys.stdout.write(output)
+        sys.exit("IOC exited with status %d" % proc.returncode)
+
+    print(match.group(0).rstrip())
+    print("    errlog: %d message(s) of devTextFile" % len(re.findall(r"^\S+ \(devTextFile", output, re.M)))
+    print("    input files rewritten %d time(s)" % rewrites)
+    with open(os.path.join(args.dir, "dbior.txt")) as f:
+        for line in f:
+            if re.match(r"\s+(memory|arena|buffers):", line):
+                print(line.rstrip())
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--dir", default="/dev/shm/devTextFileLoad",
+                        help="directory of database and files, on tmpfs (default: %(default)s)")
+    parser.add_argument("--records", type=int, default=100,
+                        help="records of each type per scan period (default: %(default)s)")
+    parser.add_argument("--periods", type=float, nargs="+", default=[1, 0.5, 0.1],
+                        help="scan periods in seconds, must be defined in menuScan (default: %(default)s)")
+    parser.add_argument("--nelm", type=int, default=1000, help="NELM of waveforms (default: %(default)s)")
+    parser.add_argument("--ftvl", nargs="+", default=["DOUBLE", "FLOAT", "LONG", "SHORT"],
+                        help="FTVLs of waveforms, used in turn (default: %(default)s)")
+    parser.add_argument("--info", nargs="*", default=[], metavar="TAG=VALUE",
+                        help="info tags of input records, e.g. TextFile:BATCH=YES")
+    parser.add_argument("--var", nargs="*", default=[], metavar="NAME=VALUE",
+                        help="variables set before iocInit, e.g. devTextFileBatchThreads=4")
+    parser.add_argument("--missing", type=float, default=0,
+                        help="fraction of input files not created, to load errlog (default: %(default)s)")
+    parser.add_argument("--update", type=float, default=1,
+                        help="period to rewrite input files in seconds, 0 to disable (default: %(default)s)")
+    parser.add_argument("--warmup", type=float, default=5, help="seconds before measuring (default: %(default)s)")
+    parser.add_argument("--duration", type=float, default=60, help="seconds to measure (default: %(default)s)")
+    parser.add_argument("--seed", type=int, default=1, help="seed of random contents (default: %(default)s)")
+    parser.add_argument("--ioc", help="IOC executable (default: <top>/bin/$EPICS_HOST_ARCH/devTextFileLoad)")
+    parser.add_argument("--generate-only", action="store_true", help="write database and files, and exit")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    files = generate(args, rng)
+    nrec = args.records * len(INPUTS + OUTPUTS) * len(args.periods)
+    print("%d record(s), %d input file(s) in %s" % (nrec, len(files), args.dir))
+
+    if not args.generate_only:
+        run(args, files, rng)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,40 @@
+// -*- coding: utf-8; mode: c++; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+//
+#include "epicsExit.h"
+#include "epicsThread.h"
+#include "iocsh.h"
+
+/////////////////////////////////////////////////////////////////
+//
+// IOC running the startup script given, interactive unless it exits
+//
+int main(int argc, char *argv[])
+{
+    if (argc >= 2) {
+        iocsh(argv[1]);
+        epicsThreadSleep(.2);
+    }
+    iocsh(NULL);
+    epicsExit(0);
+    return 0;
+}
+
+// end
@@ -0,0 +1,189 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+//
+#include "dbAccess.h"
+#include "dbStaticLib.h"
+#include "epicsTime.h"
+#include "epicsExport.h"
+#include "iocsh.h"
+
+// scan lists of the generated database, one tick record each
+#define MAX_LISTS 64
+
+//
+typedef struct {
+    char   name[PVNAME_STRINGSZ];
+    double period;                  // info tag LoadTest:PERIOD
+    long   nrec;                    // info tag LoadTest:NREC, records in the list
+    double ticks;                   // value of the tick record at the start
+} list_t;
+
+//
+static list_t lists[MAX_LISTS];
+static int nlists = 0;
+static epicsTimeStamp started;
+static struct rusage usage;
+
+// value of the tick record, incremented after all records of the list are processed
+static double getTicks(const list_t *list)
+{
+    DBADDR addr;
+    double value = 0;
+    long nelm = 1;
+
+    if (dbNameToAddr(list->name, &addr) != 0 || dbGetField(&addr, DBR_DOUBLE, &value, NULL, &nelm, NULL) != 0) {
+        return 0;
+    }
+
+    return value;
+}
+
+// resident memory of the IOC in kB, taken from /proc/self/status
+static void getMemory(long *rss, long *hwm)
+{
+    char line[128];
+    FILE *fp = fopen("/proc/self/status", "r");
+
+    *rss = *hwm = -1;
+    if (fp == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        sscanf(line, "VmRSS: %ld", rss);
+        sscanf(line, "VmHWM: %ld", hwm);
+    }
+    fclose(fp);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Look up tick records and take the baseline, called after iocInit
+//
+static void loadStart(void)
+{
+    DBENTRY dbentry;
+
+    nlists = 0;
+    dbInitEntry(pdbbase, &dbentry);
+    for (long status = dbFirstRecordType(&dbentry); status == 0 && nlists < MAX_LISTS; status = dbNextRecordType(&dbentry)) {
+        for (status = dbFirstRecord(&dbentry); status == 0; status = dbNextRecord(&dbentry)) {
+            const char *period = dbGetInfo(&dbentry, "LoadTest:PERIOD");
+            const char *nrec = dbGetInfo(&dbentry, "LoadTest:NREC");
+            if (period == NULL || nrec == NULL) {
+                continue;
+            }
+            if (nlists == MAX_LISTS) {
+                printf("devTextFileLoadStart: more than %d scan lists, the rest is ignored\n", MAX_LISTS);
+                break;
+            }
+
+            list_t *list = &lists[nlists++];
+            strncpy(list->name, dbGetRecordName(&dbentry), sizeof(list->name) - 1);
+            list->period = atof(period);
+            list->nrec = atol(nrec);
+        }
+    }
+    dbFinishEntry(&dbentry);
+
+    for (int i = 0; i < nlists; i++) {
+        lists[i].ticks = getTicks(&lists[i]);
+    }
+    epicsTimeGetCurrent(&started);
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf("devTextFileLoadStart: %d scan list(s)\n", nlists);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report rates, overruns, CPU and memory since devTextFileLoadStart
+//
+static void loadReport(void)
+{
+    epicsTimeStamp now;
+    struct rusage end;
+
+    epicsTimeGetCurrent(&now);
+    getrusage(RUSAGE_SELF, &end);
+
+    const double elapsed = epicsTimeDiffInSeconds(&now, &started);
+    if (elapsed <= 0) {
+        printf("devTextFileLoadReport: devTextFileLoadStart must be run first\n");
+        return;
+    }
+
+    //
+    double processed = 0;
+    printf("devTextFileLoadReport: %.3f s\n", elapsed);
+    printf("    %-24s %10s %8s %10s %10s %8s %12s\n", "scan list", "period", "records", "expected", "ticks", "overrun", "records/s");
+    for (int i = 0; i < nlists; i++) {
+        const list_t *list = &lists[i];
+        const double ticks = getTicks(list) - list->ticks;
+        const double expected = elapsed / list->period;
+        const double overrun = expected > ticks + 1 ? expected - ticks : 0;
+
+        processed += ticks * list->nrec;
+        printf("    %-24s %10.3f %8ld %10.0f %10.0f %8.0f %12.0f\n",
+               list->name, list->period, list->nrec, expected, ticks, overrun, ticks * list->nrec / elapsed);
+    }
+
+    //
+    const double user = (end.ru_utime.tv_sec - usage.ru_utime.tv_sec) + (end.ru_utime.tv_usec - usage.ru_utime.tv_usec) * 1e-6;
+    const double sys = (end.ru_stime.tv_sec - usage.ru_stime.tv_sec) + (end.ru_stime.tv_usec - usage.ru_stime.tv_usec) * 1e-6;
+    printf("    processed: %.0f record(s), %.0f per second\n", processed, processed / elapsed);
+    printf("    cpu: %.3f s user, %.3f s system, %.1f%% of one core, %.2f us per record\n",
+           user, sys, (user + sys) / elapsed * 100, processed > 0 ? (user + sys) / processed * 1e6 : 0);
+    printf("    context switches: %ld voluntary, %ld involuntary\n",
+           end.ru_nvcsw - usage.ru_nvcsw, end.ru_nivcsw - usage.ru_nivcsw);
+
+    long rss, hwm;
+    getMemory(&rss, &hwm);
+    if (rss >= 0) {
+        printf("    memory: %ld kB resident, %ld kB peak\n", rss, hwm);
+    }
+}
+
+// iocsh commands
+//
+static const iocshFuncDef loadStartDef = { "devTextFileLoadStart", 0, NULL };
+static const iocshFuncDef loadReportDef = { "devTextFileLoadReport", 0, NULL };
+
+static void loadStartCall(const iocshArgBuf *args)
+{
+    loadStart();
+}
+
+static void loadReportCall(const iocshArgBuf *args)
+{
+    loadReport();
+}
+
+static void devTextFileLoadRegister(void)
+{
+    iocshRegister(&loadStartDef, loadStartCall);
+    iocshRegister(&loadReportDef, loadReportCall);
+}
+
+// Register symbol(s) used by IOC core
+//
+epicsExportRegistrar(devTextFileLoadRegister);
+
+// end
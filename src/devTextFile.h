@@ -3,9 +3,14 @@
 
 //
 #include <dbScan.h>
+#include <ellLib.h>
+#include <epicsMutex.h>
+#include <epicsThreadPool.h>
+#include <epicsTime.h>
 
 //
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -13,6 +18,8 @@
 
 #define MAX_INSTIO_STRING  256
 #define ERRBUF 1024
+#define NPY_HEADER_LEN 128
+#define AGE_BINS 24
 
 //
 typedef enum {
@@ -20,15 +27,346 @@ typedef enum {
     kRead,
 } flag_t;
 
+// file format for output records
+typedef enum {
+    kText,
+    kNpy,
+} format_t;
+
+// decimation of waveform
+typedef enum {
+    kDecimNone,
+    kDecimStride,
+    kDecimMean,
+    kDecimMinMax,
+} decim_t;
+
+// statistics of waveform elements, computed while parsing
+typedef enum {
+    kStatNone,
+    kStatMin,
+    kStatMax,
+    kStatSum,
+    kStatMean,
+    kStatRms,
+    kStatCount,
+} stat_t;
+
+// stages of read and write recorded by tracing
+typedef enum {
+    kTraceRead,
+    kTraceOpen,
+    kTraceParse,
+    kTraceConvert,
+    kTraceErrlog,
+    kTraceWrite,
+    kTraceClose,
+} trace_t;
+
+typedef struct {
+    double       min;
+    double       max;
+    double       sum;
+    double       sumsq;
+    uint32_t     count;
+} TextFileStats_t;
+
+// histogram of age of the contents, i.e. time of read minus modification time
+typedef struct {
+    uint32_t     bins[AGE_BINS]; // log2 of milliseconds
+    uint32_t     count;
+    uint32_t     negative;  // modified in the future
+    double       sum;       // in seconds
+    double       max;
+} TextFileAge_t;
+
+// process-wide entry shared by all records referring to the same file
+typedef struct {
+    const char  *path;      // interned
+    epicsMutexId lock;
+    IOSCANPVT    ioscanpvt; // processes input records with SCAN="I/O Intr" when written by output record
+    IOSCANPVT    statscan;  // processes companion records with SCAN="I/O Intr"
+    int          nstats;    // number of companion records of statistics
+    TextFileStats_t stats;  // statistics of the latest read, guarded by lock
+    bool         cached;    // value written by output record in this IOC, guarded by lock
+    char         text[32];  // value as written to the file
+    double       value;
+    dev_t        dev;       // identity of the file just after written
+    ino_t        ino;
+    off_t        size;
+    struct timespec mtime;
+    IOSCANPVT    pollscan;  // processes records with TextFile:POLL when the file is changed
+    int          npoll;     // number of records watching the file, guarded by poller lock
+    int          pollerr;   // errno of the latest stat(), 0 on success
+    struct stat  pollst;    // result of the latest stat()
+    double       pollint;   // current polling interval in seconds
+    epicsTimeStamp pollnext; // time of the next stat()
+    uint32_t     npolls;    // total number of stat() calls
+    uint32_t     nchanges;  // total number of changes detected
+    int          negerr;    // errno of the latest failed open, 0 if not failing, guarded by lock
+    double       negint;    // current interval between attempts to open
+    epicsTimeStamp negnext; // time of the next attempt to open
+    uint32_t     nskipped;  // total number of reads skipped while backing off
+} TextFileEntry_t;
+
+// records sharing a scan period or a read group, read together (devTextFileBatch.c)
+typedef struct TextFileBatch TextFileBatch_t;
+
+// contents of the file of a member read by the batch read (devTextFileBatch.c)
+typedef struct TextFileMember TextFileMember_t;
+
+// pseudo-file of sysfs/procfs kept open (devTextFileSysfs.c)
+typedef struct TextFileSysfs TextFileSysfs_t;
+
+// .npy header of output record (devTextFileNpy.c)
+typedef struct TextFileNpy TextFileNpy_t;
+
+// smoothed values of waveform for TextFile:SMOO (devTextFileConv.c)
+typedef struct TextFileSmooth TextFileSmooth_t;
+
+// files in a directory matching a pattern, read into a waveform (devTextFileGlob.c)
+typedef struct TextFileGlob TextFileGlob_t;
+
+// file read and decoded in background, copied by the record (devTextFileRefresh.c)
+typedef struct TextFileRefresh TextFileRefresh_t;
+
+// large file parsed by a pool of threads (devTextFileParallel.c)
+typedef struct TextFileParallel TextFileParallel_t;
+
+// contents checked against CRC-32C in the trailer line (devTextFileCrc.c)
+typedef struct TextFileCrc TextFileCrc_t;
+
+// values pushed through FIFO or Unix domain socket (devTextFileStream.c)
+typedef struct TextFileStream TextFileStream_t;
+
+// values exchanged through POSIX shared memory (devTextFileShm.c)
+typedef struct TextFileShm TextFileShm_t;
+
+// directory kept open for openat() of the files in it (devTextFileDir.c)
+typedef struct TextFileDir TextFileDir_t;
+
+// output file kept open and updated in place (devTextFileInplace.c)
+typedef struct TextFileInplace TextFileInplace_t;
+
+// values of large file cached in binary form (devTextFileSidecar.c)
+typedef struct TextFileSidecar TextFileSidecar_t;
+
+// page cache policy of large files (devTextFileAdvise.c)
+typedef struct TextFileAdvise TextFileAdvise_t;
+
 //
 typedef struct {
+    ELLNODE      node;      // in the list of all records, must be the first member
+    dbCommon    *prec;
     IOSCANPVT    ioscanpvt;
-    char        *name;
-    char         errmsg[ERRBUF];
+    const char  *name;      // interned, see devTextFileIntern()
+    TextFileDir_t *dir;     // directory of name, NULL if name is not a file
+    const char  *base;      // name relative to dir
     flag_t       flag;
+    format_t     format;
+    TextFileNpy_t *npy;     // .npy header for output record, NULL if not written in npy format
+    bool         linconv;   // apply ASLO/AOFF/SMOO to waveform elements
+    double       aslo;
+    double       aoff;
+    double       smoo;
+    TextFileSmooth_t *smooth; // smoothed values of the previous read, NULL if SMOO is not given
+    TextFileEntry_t *entry;
+    stat_t       stat;      // kind of statistics for companion records
+    bool         dostats;   // compute statistics while parsing
+    TextFileStats_t stats;
+    decim_t      decimate;
+    size_t       maxline;   // maximum length of line, 0 for devTextFileMaxLine
+    size_t       maxbytes;  // maximum bytes per read, 0 for devTextFileMaxBytes
+    size_t       nbytes;    // bytes read in this read
+    uint32_t     overlong;  // lines skipped in this read
+    bool         capped;    // reached maximum bytes in this read
+    bool         torn;      // contents didn't match the trailer in this read
+    uint32_t     noverlong; // total number of skipped lines
+    uint32_t     ncapped;   // total number of reads stopped by maximum bytes
+    uint32_t     ncached;   // total number of reads from write-through cache
+    TextFileBatch_t *batch; // batch of records read together, NULL if read individually
+    TextFileMember_t *member; // contents read by the batch read, NULL if read individually
+    bool         poll;      // processed with SCAN="I/O Intr" when the file is changed
+    TextFileSysfs_t *sysfs; // pseudo-file of sysfs/procfs kept open and read by pread(), NULL for regular file
+    TextFileGlob_t *glob;   // pattern in INP, NULL if INP is a single file
+    TextFileAge_t *age;     // histogram of age for TextFile:FRESHNESS, NULL if disabled
+    TextFileRefresh_t *refresh; // refresher for TextFile:REFRESH, NULL if read by the record
+    TextFileParallel_t *parallel; // for TextFile:PARALLEL, NULL if parsed by a single thread
+    TextFileCrc_t *crc;     // for TextFile:CRC, NULL if not checked
+    TextFileStream_t *stream; // for TextFile:STREAM, NULL if read from file
+    TextFileShm_t *shm;     // for TextFile:SHM, NULL if read from or written to file
+    TextFileInplace_t *inplace; // for TextFile:INPLACE, NULL if the file is written in full
+    TextFileSidecar_t *sidecar; // for TextFile:SIDECAR, NULL if parsed every time
+    TextFileAdvise_t *advise; // for TextFile:ADVISE and TextFile:PREFETCH, NULL for devTextFileAdvise
 } TextFile_t;
 
+// add a value to statistics, in the loop storing the values
+static inline void devTextFileStatsAdd(TextFileStats_t *stats, double dval)
+{
+    if (dval < stats->min) {
+        stats->min = dval;
+    }
+    if (dval > stats->max) {
+        stats->max = dval;
+    }
+    stats->sum   += dval;
+    stats->sumsq += dval * dval;
+    stats->count ++;
+}
+
 //
+long devTextFileParse(FILE *fp, const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int *nline, TextFileStats_t *stats, int debug);
+long devTextFileDecode(FILE *fp, const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, TextFileStats_t *stats, int debug);
 long devTextFileRead(const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int debug);
+char *devTextFileFirstValue(char *buf, size_t maxline, bool truncated, uint32_t *overlong);
+bool devTextFileStoreValue(const char *pbuf, void *bptr, int ftvl, uint32_t index, TextFileStats_t *stats);
+size_t devTextFileLineLimit(const TextFile_t *dpvt);
+size_t devTextFileByteLimit(const TextFile_t *dpvt);
+
+//
+const char *devTextFileGetInfo(dbCommon *prec, const char *name);
+long devTextFileConfig(dbCommon *prec, TextFile_t *dpvt);
+long devTextFileReport(int level, const void *pdset);
+
+//
+TextFileEntry_t *devTextFileEntryGet(const char *path);
+void devTextFileCachePublish(TextFile_t *dpvt, FILE *fp, const char *text, double value);
+void devTextFileCacheStore(TextFile_t *dpvt, const struct stat *st, const char *text, double value);
+void devTextFileCacheInvalidate(TextFile_t *dpvt);
+long devTextFileCacheRead(dbCommon *prec, void *bptr, int ftvl);
+int devTextFileNegativeCheck(TextFileEntry_t *entry);
+bool devTextFileNegativeFail(TextFileEntry_t *entry, int err);
+void devTextFileNegativeClear(TextFileEntry_t *entry);
+long devTextFileStatsInit(dbCommon *prec, TextFile_t *dpvt);
+void devTextFileStatsPublish(TextFile_t *dpvt);
+void devTextFileStatsReset(TextFileStats_t *stats);
+void devTextFileStatsMerge(TextFileStats_t *stats, const TextFileStats_t *part);
+void devTextFileStatsCopy(void *dst, const void *src, int ftvl, size_t size, uint32_t n, TextFileStats_t *stats);
+long devTextFileStatsRead(dbCommon *prec, double *val);
+
+//
+void devTextFileConvert(TextFile_t *dpvt, void *bptr, int ftvl, uint32_t n, TextFileStats_t *stats);
+void devTextFileSmoothInit(TextFile_t *dpvt, uint32_t nelm);
+
+//
+long devTextFileNpyInit(dbCommon *prec, int ftvl, int nelm);
+long devTextFileNpyRead(const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int debug);
+long devTextFileNpyWrite(const char *filename, const void *bptr, dbCommon *prec, int ftvl, int nelm, int debug);
+
+//
+long devTextFileBatchJoin(dbCommon *prec, TextFile_t *dpvt);
+long devTextFileGroupJoin(dbCommon *prec, TextFile_t *dpvt, const char *name);
+FILE *devTextFileBatchOpen(dbCommon *prec);
+void devTextFileBatchClose(dbCommon *prec);
+void devTextFileBatchReport(const TextFile_t *dpvt);
+bool devTextFileBatchStale(const TextFile_t *dpvt);
+size_t devTextFileBatchMemory(const TextFile_t *dpvt);
+epicsThreadPool *devTextFileThreadPool(void);
+int devTextFileThreads(void);
+
+//
+void devTextFilePollWatch(TextFile_t *dpvt, bool watch);
+void devTextFilePollReport(const TextFile_t *dpvt);
+
+//
+long devTextFileSysfsInit(dbCommon *prec, TextFile_t *dpvt);
+long devTextFileSysfsRead(const char *filename, void *bptr, dbCommon *prec, int ftvl, int debug);
+FILE *devTextFileSysfsOpen(dbCommon *prec);
+void devTextFileSysfsWatch(TextFile_t *dpvt, bool watch);
+int devTextFileSysfsFd(const TextFile_t *dpvt);
+size_t devTextFileSysfsMemory(const TextFile_t *dpvt);
+
+//
+long devTextFileGlobInit(dbCommon *prec, TextFile_t *dpvt);
+long devTextFileGlobRead(dbCommon *prec, void *bptr, int ftvl, int nelm, int debug);
+void devTextFileGlobReport(const TextFile_t *dpvt);
+
+//
+void devTextFileFreshInit(TextFile_t *dpvt);
+void devTextFileFresh(dbCommon *prec, int fd);
+void devTextFileFreshTime(dbCommon *prec, const struct timespec *ts);
+void devTextFileFreshReport(const TextFile_t *dpvt);
+
+//
+long devTextFileRefreshInit(dbCommon *prec, TextFile_t *dpvt, double period);
+long devTextFileRefreshRead(dbCommon *prec, void *bptr, int ftvl, int nelm, int debug);
+void devTextFileRefreshReport(const TextFile_t *dpvt);
+
+//
+long devTextFileParallelInit(dbCommon *prec, TextFile_t *dpvt);
+long devTextFileParallelParse(FILE *fp, const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int *nline, TextFileStats_t *stats, int debug);
+void devTextFileParallelReport(const TextFile_t *dpvt);
+
+//
+uint32_t devTextFileCrc32c(const void *buf, size_t len);
+long devTextFileCrcInit(dbCommon *prec, TextFile_t *dpvt);
+long devTextFileCrcParse(FILE *fp, const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int *nline, TextFileStats_t *stats, int debug);
+void devTextFileCrcReport(const TextFile_t *dpvt);
+
+//
+long devTextFileStreamInit(dbCommon *prec, TextFile_t *dpvt);
+long devTextFileStreamStart(dbCommon *prec, int ftvl, int nelm);
+long devTextFileStreamRead(dbCommon *prec, void *bptr, int ftvl, int nelm, int debug);
+void devTextFileStreamReport(const TextFile_t *dpvt);
+
+//
+long devTextFileShmInit(dbCommon *prec, TextFile_t *dpvt);
+long devTextFileShmRead(dbCommon *prec, void *bptr, int ftvl, int nelm, int debug);
+long devTextFileShmWrite(dbCommon *prec, const void *bptr, int ftvl, int nelm, int count, int debug);
+void devTextFileShmWatch(TextFile_t *dpvt, bool watch);
+void devTextFileShmReport(const TextFile_t *dpvt);
+
+//
+void devTextFileDirInit(TextFile_t *dpvt);
+int devTextFileOpen(TextFile_t *dpvt, int flags, mode_t mode);
+FILE *devTextFileFopen(TextFile_t *dpvt, const char *mode);
+int devTextFileStat(TextFile_t *dpvt, struct stat *st);
+int devTextFileDirFd(TextFile_t *dpvt, const char **name);
+void devTextFileDirReport(void);
+
+//
+long devTextFileInplaceInit(dbCommon *prec, TextFile_t *dpvt);
+long devTextFileInplaceWrite(dbCommon *prec, const char *writer, const char *text, double value, int debug);
+void devTextFileInplaceReport(const TextFile_t *dpvt);
+
+//
+long devTextFileSidecarInit(dbCommon *prec, TextFile_t *dpvt);
+long devTextFileSidecarLoad(FILE *fp, void *bptr, dbCommon *prec, int ftvl, int nelm, TextFileStats_t *stats, int debug);
+void devTextFileSidecarStore(FILE *fp, const void *bptr, dbCommon *prec, int ftvl, int nelm, long n, const TextFileStats_t *stats);
+void devTextFileSidecarReport(const TextFile_t *dpvt);
+long devTextFileSidecarDir(const char *dir);
+
+//
+long devTextFileAdviseInit(dbCommon *prec, TextFile_t *dpvt, const char *value, bool prefetch);
+bool devTextFileAdviseRead(dbCommon *prec, FILE *fp);
+void devTextFileAdviseDone(dbCommon *prec, FILE *fp, bool advised);
+void devTextFileAdviseReport(const TextFile_t *dpvt);
+
+//
+TextFile_t *devTextFileAlloc(void);
+const char *devTextFileIntern(const char *str);
+void *devTextFileCalloc(size_t count, size_t size, const char *errmsg);
+const char *devTextFileStrerror(int err);
+void devTextFileMemReport(size_t buffers);
+
+//
+extern int devTextFileTrace;
+void devTextFileTraceEvent(const dbCommon *prec, trace_t stage, char phase);
+long devTextFileTraceDump(const char *filename);
+
+// a single branch when tracing is disabled
+#define TRACE_BEGIN(prec, stage)                                        \
+    do {                                                                \
+        if (__builtin_expect(devTextFileTrace, 0)) {                    \
+            devTextFileTraceEvent((const dbCommon *)(prec), (stage), 'B'); \
+        }                                                               \
+    } while (0)
+
+#define TRACE_END(prec, stage)                                          \
+    do {                                                                \
+        if (__builtin_expect(devTextFileTrace, 0)) {                    \
+            devTextFileTraceEvent((const dbCommon *)(prec), (stage), 'E'); \
+        }                                                               \
+    } while (0)
 
 #endif
@@ -0,0 +1,289 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+//
+#include "aaoRecord.h"
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "devSup.h"
+#include "alarm.h"
+#include "errlog.h"
+#include "recGbl.h"
+#include "link.h"
+#include "epicsExport.h"
+#include "epicsTime.h"
+
+//
+#include "devTextFile.h"
+
+//
+static int devTextFileAaoDebug = 0;
+
+/***************************************************************
+ * aao (command/response IO)
+ ***************************************************************/
+static long report(int);
+static long init(void);
+static long init_record(struct aaoRecord *);
+static long write_aao(struct aaoRecord *);
+
+struct {
+    long        number;
+    DEVSUPFUN   report;
+    DEVSUPFUN   init;
+    DEVSUPFUN   init_record;
+    DEVSUPFUN   get_ioint_info;
+    DEVSUPFUN   write_aao;
+} devTextFileAao = {
+    5,
+    report,
+    init,
+    init_record,
+    NULL,
+    write_aao,
+};
+
+epicsExportAddress(dset, devTextFileAao);
+
+//
+static long report(int level)
+{
+    return devTextFileReport(level, &devTextFileAao);
+}
+
+//
+static long init(void)
+{
+    return 0;
+}
+
+//
+static long init_record(struct aaoRecord *prec)
+{
+    DBLINK *plink = &prec->out;
+
+    //
+    if (devTextFileAaoDebug > 0) {
+        printf("%s (devTextFileAao): out=%s nelm=%d\n", prec->name, plink->value.instio.string, prec->nelm);
+    }
+
+    // Link type must be INST_IO
+    if (plink->type != INST_IO) {
+        errlogPrintf("%s (devTextFileAao): address type must be \"INST_IO\"\n", prec->name);
+        prec->pact = 1;
+        return -1;
+    }
+
+    // Check FTVL field
+    switch (prec->ftvl) {
+    case DBF_CHAR:
+    case DBF_UCHAR:
+    case DBF_SHORT:
+    case DBF_USHORT:
+    case DBF_LONG:
+    case DBF_ULONG:
+    case DBF_FLOAT:
+    case DBF_DOUBLE:
+        break;
+    default:
+        errlogPrintf("%s (devTextFileAao): unsuppoted FTVL\n", prec->name);
+        prec->pact = 1;
+        return -1;
+    }
+
+    // Allocate private data storage area
+    TextFile_t *dpvt = devTextFileAlloc();
+    prec->dpvt = dpvt;
+
+    // Extract output filename
+    const char *pstr = plink->value.instio.string;
+
+    // check if read flag is specified in OUT field
+    if (pstr[0] == '<') {
+        dpvt->flag = kRead;
+        pstr++;
+    }
+
+    // records referring to the same file share the name
+    dpvt->name = devTextFileIntern(pstr);
+
+    // Configure options from info tags
+    if (devTextFileConfig((dbCommon *)prec, dpvt) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
+
+    // Prepare header for npy format
+    if (dpvt->format == kNpy) {
+        if (devTextFileNpyInit((dbCommon *)prec, prec->ftvl, prec->nelm) < 0) {
+            prec->pact = 1;
+            return -1;
+        }
+    }
+
+    //
+    if (dpvt->flag == kRead) {
+        const char *filename = pstr;
+
+        // aaoRecord allocates the buffer after init_record unless device support does
+        if (prec->bptr == NULL) {
+            prec->bptr = callocMustSucceed(prec->nelm, dbValueSize(prec->ftvl), "calloc for aao buffer failed");
+        }
+
+        //
+        long ret;
+        if (dpvt->format == kNpy) {
+            ret = devTextFileNpyRead(filename, prec->bptr, (dbCommon *)prec, prec->ftvl, prec->nelm, devTextFileAaoDebug);
+        } else {
+            ret = devTextFileRead(filename, prec->bptr, (dbCommon *)prec, prec->ftvl, prec->nelm, devTextFileAaoDebug);
+        }
+
+        //
+        if (ret < 0) {
+            prec->nord = 0;
+            return -1;
+        }
+
+        //
+        prec->nord = ret;
+    }
+
+    //
+    return 0;
+}
+
+//
+static long write_aao(struct aaoRecord *prec)
+{
+    //DBLINK *plink = &prec->out;
+    TextFile_t *dpvt = prec->dpvt;
+    const char *filename = dpvt->name;
+
+    //
+    if (devTextFileAaoDebug > 0) {
+        printf("%s (devTextFileAao): filename: %s, nord:%d\n", prec->name, filename, prec->nord);
+    }
+
+    // arrays are not cached
+    devTextFileCacheInvalidate(dpvt);
+
+    // shared memory: published to readers without system calls
+    if (dpvt->shm) {
+        long ret = devTextFileShmWrite((dbCommon *)prec, prec->bptr, prec->ftvl, prec->nelm, prec->nord, devTextFileAaoDebug);
+
+        //
+        prec->udf = FALSE;
+
+        //
+        return ret;
+    }
+
+    // npy format: header built in init_record followed by raw binary array
+    if (dpvt->format == kNpy) {
+        long ret = devTextFileNpyWrite(filename, prec->bptr, (dbCommon *)prec, prec->ftvl, prec->nord, devTextFileAaoDebug);
+
+        //
+        prec->udf = FALSE;
+
+        //
+        return ret;
+    }
+
+    //
+    FILE *fp = devTextFileFopen(dpvt, "w");
+    if (fp == NULL) {
+        const char *errmsg = devTextFileStrerror(errno);
+        errlogPrintf("%s (devTextFileAao): can't open \"%s\" for writing: %s\n", prec->name, filename, errmsg);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = WRITE_ACCESS_ALARM;
+        return -1;
+    }
+
+    //
+    int retval = 0;
+
+    // timestamp
+    char datetime[128];
+    epicsTimeToStrftime(datetime, sizeof(datetime), "%Y-%m-%d %T", &prec->time);
+
+    char wday[32];
+    epicsTimeToStrftime(wday, sizeof(wday), "(%a)", &prec->time);
+
+    // hostname
+    // gethostname() won't work if /etc/hostname is empty
+    struct utsname buf;
+    uname(&buf);
+
+    //
+    if (devTextFileAaoDebug > 0) {
+        printf("%s (devTextFileAao): %s.%06d %s\n", prec->name, datetime, prec->time.nsec/1000, wday);
+    }
+
+    //
+    int ret = fprintf(fp,
+                      "# saved by devTextFileAao on %s\n# %s as of %s.%06d %s\n",
+                      buf.nodename,
+                      prec->name, datetime, prec->time.nsec/1000, wday);
+
+    // one element per line
+    for (uint32_t i = 0; i < prec->nord && ret >= 0; i++) {
+        switch (prec->ftvl) {
+        case DBF_CHAR:   ret = fprintf(fp, "%d\n",    ((int8_t   *)prec->bptr)[i]); break;
+        case DBF_UCHAR:  ret = fprintf(fp, "%u\n",    ((uint8_t  *)prec->bptr)[i]); break;
+        case DBF_SHORT:  ret = fprintf(fp, "%d\n",    ((int16_t  *)prec->bptr)[i]); break;
+        case DBF_USHORT: ret = fprintf(fp, "%u\n",    ((uint16_t *)prec->bptr)[i]); break;
+        case DBF_LONG:   ret = fprintf(fp, "%d\n",    ((int32_t  *)prec->bptr)[i]); break;
+        case DBF_ULONG:  ret = fprintf(fp, "%u\n",    ((uint32_t *)prec->bptr)[i]); break;
+        case DBF_FLOAT:  ret = fprintf(fp, "%.9g\n",  ((float    *)prec->bptr)[i]); break;
+        case DBF_DOUBLE: ret = fprintf(fp, "%.17lg\n", ((double  *)prec->bptr)[i]); break;
+        }
+    }
+
+    if (ret < 0) {
+        // write error
+        errlogPrintf("%s (devTextFileAao): No data was written to the file: \"%s\"\n", prec->name, filename);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = WRITE_ALARM;
+        retval = -1;
+    }
+
+    //
+    prec->udf = FALSE;
+
+    // cleanup
+    fclose(fp);
+    fp = NULL;
+
+    //
+    return retval;
+}
+
+// Register symbol(s) used by IOC core
+epicsExportAddress(int, devTextFileAaoDebug);
+
+// end
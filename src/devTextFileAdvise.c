@@ -0,0 +1,298 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "dbScan.h"
+#include "errlog.h"
+#include "epicsEvent.h"
+#include "epicsExport.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "epicsTime.h"
+
+//
+#include "devTextFile.h"
+
+// policy of records without TextFile:ADVISE, 0: none, 1: sequential, 2: dontneed
+static int devTextFileAdvise = 0;
+
+// files smaller than this are read without advice
+static int devTextFileAdviseMin = 1048576;
+
+// seconds before the next scan to prefetch the file for TextFile:PREFETCH
+static double devTextFilePrefetchLead = 0.2;
+
+//
+typedef enum {
+    kAdviseGlobal = -1, // devTextFileAdvise
+    kAdviseNone,
+    kAdviseSequential,  // POSIX_FADV_SEQUENTIAL and POSIX_FADV_WILLNEED before parsing
+    kAdviseDontneed,    // and POSIX_FADV_DONTNEED after parsing
+} advise_t;
+
+static const char *adviseNames[] = { "none", "sequential", "dontneed" };
+
+// page cache policy of a record, attached to TextFile_t
+struct TextFileAdvise {
+    TextFile_t     *dpvt;
+    advise_t        mode;
+    bool            prefetch;   // for TextFile:PREFETCH
+    double          period;     // of SCAN
+    bool            scheduled;  // next is valid, guarded by adviseLock
+    epicsTimeStamp  next;       // time to prefetch, guarded by adviseLock
+    uint32_t        nadvised;   // reads advised
+    uint32_t        ndropped;   // reads followed by POSIX_FADV_DONTNEED
+    uint32_t        nprefetched; // prefetches issued by the prefetch thread
+    uint32_t        nfailed;    // prefetches failed to open the file
+};
+
+//
+static TextFileAdvise_t **prefetchList = NULL; // records of TextFile:PREFETCH, guarded by adviseLock
+static int prefetchCount = 0;
+static epicsMutexId adviseLock = NULL;
+static epicsEventId adviseWakeup = NULL;
+static epicsThreadOnceId adviseOnce = EPICS_THREAD_ONCE_INIT;
+
+//
+static advise_t adviseMode(const TextFile_t *dpvt)
+{
+    if (dpvt->advise && dpvt->advise->mode != kAdviseGlobal) {
+        return dpvt->advise->mode;
+    }
+    return (devTextFileAdvise >= kAdviseNone && devTextFileAdvise <= kAdviseDontneed) ? devTextFileAdvise : kAdviseNone;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Prefetch thread: ask the kernel to read files ahead just before the records
+// are scanned, so that the scan finds the contents in page cache
+//
+static void prefetchThread(void *arg)
+{
+    while (true) {
+        double wait = 10.0;
+
+        epicsMutexMustLock(adviseLock);
+        const int count = prefetchCount;
+        epicsMutexUnlock(adviseLock);
+
+        for (int i = 0; i < count; i++) {
+            epicsTimeStamp now;
+            epicsTimeGetCurrent(&now);
+
+            epicsMutexMustLock(adviseLock);
+            TextFileAdvise_t *a = prefetchList[i];
+            const double due = epicsTimeDiffInSeconds(&a->next, &now);
+            const bool run = a->scheduled && due <= 0;
+            if (run) {
+                a->scheduled = false; // scheduled again by the next read
+            } else if (a->scheduled && due < wait) {
+                wait = due;
+            }
+            epicsMutexUnlock(adviseLock);
+
+            if (!run) {
+                continue;
+            }
+
+            // open() on a network file system may take a while, done without the lock
+            int fd = devTextFileOpen(a->dpvt, O_RDONLY, 0);
+            if (fd < 0) {
+                a->nfailed ++;
+                continue;
+            }
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            close(fd);
+            a->nprefetched ++;
+        }
+
+        // woken up when a prefetch is scheduled
+        epicsEventWaitWithTimeout(adviseWakeup, wait);
+    }
+}
+
+//
+static void adviseInit(void *arg)
+{
+    adviseLock = epicsMutexMustCreate();
+    adviseWakeup = epicsEventMustCreate(epicsEventEmpty);
+
+    epicsThreadMustCreate("devTextFilePrefetch", epicsThreadPriorityLow,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          prefetchThread, NULL);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Parse info tags TextFile:ADVISE and TextFile:PREFETCH, called from devTextFileConfig()
+//
+long devTextFileAdviseInit(dbCommon *prec, TextFile_t *dpvt, const char *value, bool prefetch)
+{
+    advise_t mode = kAdviseGlobal;
+    if (value) {
+        for (mode = kAdviseNone; mode <= kAdviseDontneed; mode++) {
+            if (strcasecmp(value, adviseNames[mode]) == 0) {
+                break;
+            }
+        }
+        if (mode > kAdviseDontneed) {
+            errlogPrintf("%s (%s): unknown TextFile:ADVISE \"%s\"\n", prec->name, __func__, value);
+            return -1;
+        }
+    }
+
+    //
+    if (dpvt->stream || dpvt->shm || dpvt->sysfs) {
+        errlogPrintf("%s (%s): TextFile:ADVISE and TextFile:PREFETCH can't be used with TextFile:STREAM, TextFile:SHM or TextFile:SYSFS\n", prec->name, __func__);
+        return -1;
+    }
+    if (prefetch && (dpvt->batch || dpvt->refresh || prec->scan < SCAN_1ST_PERIODIC)) {
+        errlogPrintf("%s (%s): TextFile:PREFETCH requires periodic SCAN, and can't be used with TextFile:BATCH, TextFile:GROUP or TextFile:REFRESH\n", prec->name, __func__);
+        return -1;
+    }
+
+    //
+    TextFileAdvise_t *a = devTextFileCalloc(1, sizeof(TextFileAdvise_t), "calloc for page cache policy failed");
+    a->dpvt = dpvt;
+    a->mode = mode;
+    a->prefetch = prefetch;
+    dpvt->advise = a;
+
+    if (!prefetch) {
+        return 0;
+    }
+
+    //
+    a->period = scanPeriod(prec->scan);
+    if (a->period <= devTextFilePrefetchLead) {
+        errlogPrintf("%s (%s): scan period %g s is not longer than devTextFilePrefetchLead\n", prec->name, __func__, a->period);
+        return -1;
+    }
+
+    epicsThreadOnce(&adviseOnce, adviseInit, NULL);
+
+    epicsMutexMustLock(adviseLock);
+    TextFileAdvise_t **list = realloc(prefetchList, (prefetchCount + 1) * sizeof(TextFileAdvise_t *));
+    if (list == NULL) {
+        cantProceed("realloc for prefetch failed");
+    }
+    prefetchList = list;
+    prefetchList[prefetchCount++] = a;
+    epicsMutexUnlock(adviseLock);
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Advise the kernel before parsing the opened file, called from
+// devTextFileDecode(). Returns true if the file is large enough to be advised.
+//
+bool devTextFileAdviseRead(dbCommon *prec, FILE *fp)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    struct stat st;
+
+    const advise_t mode = adviseMode(dpvt);
+    if (mode == kAdviseNone) {
+        return false;
+    }
+
+    // batch and sysfs records are parsed from memory
+    const int fd = fileno(fp);
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < devTextFileAdviseMin) {
+        return false;
+    }
+
+    // larger readahead window, and the rest of the file read asynchronously
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+    if (dpvt->advise) {
+        dpvt->advise->nadvised ++;
+    }
+
+    //
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Drop the file from page cache after parsing if configured, and schedule the
+// prefetch before the next scan. Called from devTextFileDecode().
+//
+void devTextFileAdviseDone(dbCommon *prec, FILE *fp, bool advised)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileAdvise_t *a = dpvt->advise;
+
+    if (advised && adviseMode(dpvt) == kAdviseDontneed) {
+        posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_DONTNEED);
+        if (a) {
+            a->ndropped ++;
+        }
+    }
+
+    //
+    if (a && a->prefetch) {
+        epicsMutexMustLock(adviseLock);
+        epicsTimeGetCurrent(&a->next);
+        epicsTimeAddSeconds(&a->next, a->period - devTextFilePrefetchLead);
+        a->scheduled = true;
+        epicsMutexUnlock(adviseLock);
+
+        epicsEventSignal(adviseWakeup);
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report page cache policy of the record, called from devTextFileReport()
+//
+void devTextFileAdviseReport(const TextFile_t *dpvt)
+{
+    const TextFileAdvise_t *a = dpvt->advise;
+
+    printf("        page cache: %s%s, %u read(s) advised, %u dropped",
+           adviseNames[adviseMode(dpvt)], (a->mode == kAdviseGlobal) ? " (devTextFileAdvise)" : "", a->nadvised, a->ndropped);
+    if (a->prefetch) {
+        printf(", %u prefetch(es), %u failed", a->nprefetched, a->nfailed);
+    }
+    printf("\n");
+}
+
+// Register symbol(s) used by IOC core
+epicsExportAddress(int, devTextFileAdvise);
+epicsExportAddress(int, devTextFileAdviseMin);
+epicsExportAddress(double, devTextFilePrefetchLead);
+
+// end
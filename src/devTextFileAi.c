@@ -46,8 +46,10 @@ static int devTextFileAiDebug = 0;
 /***************************************************************
  * ai (command/response IO)
  ***************************************************************/
+static long report(int);
 static long init(void);
 static long init_record(struct aiRecord *);
+static long get_ioint_info(int, struct dbCommon *, IOSCANPVT *);
 static long read_ai(struct aiRecord *);
 
 struct {
@@ -60,16 +62,22 @@ struct {
     DEVSUPFUN   special_linconv;
 } devTextFileAi = {
     6,
-    NULL,
+    report,
     init,
     init_record,
-    NULL,
+    get_ioint_info,
     read_ai,
     NULL
 };
 
 epicsExportAddress(dset, devTextFileAi);
 
+//
+static long report(int level)
+{
+    return devTextFileReport(level, &devTextFileAi);
+}
+
 //
 static long init(void)
 {
@@ -94,7 +102,7 @@ static long init_record(struct aiRecord *prec)
     }
 
     // Allocate private data storage area
-    TextFile_t *dpvt = callocMustSucceed(1, sizeof(TextFile_t), "calloc for private_t failed ");
+    TextFile_t *dpvt = devTextFileAlloc();
     prec->dpvt = dpvt;
 
     // Extract input filename
@@ -106,16 +114,29 @@ static long init_record(struct aiRecord *prec)
         pstr++;
     }
 
-    const size_t fsize = strlen(pstr) + 1;
-    //if (fsize > MAX_INSTIO_STRING) {
-    //    errlogPrintf("%s (devTextFileLi): INP field is too long\n", prec->name);
-    //    return -1;
-    //}
-    dpvt->name = callocMustSucceed(1, fsize, "calloc for filename failed");
-    strcpy(dpvt->name, pstr);
+    // records referring to the same file share the name
+    dpvt->name = devTextFileIntern(pstr);
+
+    // Check if this is a companion record of statistics, e.g. "@/path/to/file?mean"
+    if (devTextFileStatsInit((dbCommon *)prec, dpvt) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
+
+    // Configure options from info tags
+    if (devTextFileConfig((dbCommon *)prec, dpvt) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
+
+    // values pushed through FIFO or socket, see TextFile:STREAM
+    if (dpvt->stream && devTextFileStreamStart((dbCommon *)prec, DBF_DOUBLE, 1) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
 
     //
-    if (dpvt->flag == kRead) {
+    if (dpvt->flag == kRead && dpvt->stat == kStatNone) {
         const char *filename = pstr;
         double val = 0;
 
@@ -141,6 +162,29 @@ static long init_record(struct aiRecord *prec)
     return 2; // no conversion
 }
 
+//
+static long get_ioint_info(int cmd, struct dbCommon *prec, IOSCANPVT *ppvt)
+{
+    TextFile_t *dpvt = prec->dpvt;
+
+    //
+    *ppvt = dpvt->ioscanpvt;
+
+    // poll the file while the record is scanned by I/O Intr
+    if (dpvt->poll) {
+        devTextFilePollWatch(dpvt, cmd == 0);
+    }
+    if (dpvt->sysfs) {
+        devTextFileSysfsWatch(dpvt, cmd == 0);
+    }
+    if (dpvt->shm) {
+        devTextFileShmWatch(dpvt, cmd == 0);
+    }
+
+    //
+    return 0;
+}
+
 //
 static long read_ai(struct aiRecord *prec)
 {
@@ -155,7 +199,12 @@ static long read_ai(struct aiRecord *prec)
 
     //
     double val = 0;
-    long ret = devTextFileRead(filename, &val, (dbCommon *)prec, DBF_DOUBLE, 1, devTextFileAiDebug);
+    long ret;
+    if (dpvt->stat != kStatNone) {
+        ret = devTextFileStatsRead((dbCommon *)prec, &val);
+    } else {
+        ret = devTextFileRead(filename, &val, (dbCommon *)prec, DBF_DOUBLE, 1, devTextFileAiDebug);
+    }
 
     //
     if (ret < 0) {
@@ -47,6 +47,7 @@ static int devTextFileAoDebug = 0;
 /***************************************************************
  * ao (command/response IO)
  ***************************************************************/
+static long report(int);
 static long init(void);
 static long init_record(struct aoRecord *);
 static long write_ao(struct aoRecord *);
@@ -61,7 +62,7 @@ struct {
     DEVSUPFUN   special_linconv;
 } devTextFileAo = {
     6,
-    NULL,
+    report,
     init,
     init_record,
     NULL,
@@ -71,6 +72,12 @@ struct {
 
 epicsExportAddress(dset, devTextFileAo);
 
+//
+static long report(int level)
+{
+    return devTextFileReport(level, &devTextFileAo);
+}
+
 //
 static long init(void)
 {
@@ -95,7 +102,7 @@ static long init_record(struct aoRecord *prec)
     }
 
     // Allocate private data storage area
-    TextFile_t *dpvt = callocMustSucceed(1, sizeof(TextFile_t), "calloc for private_t failed ");
+    TextFile_t *dpvt = devTextFileAlloc();
     prec->dpvt = dpvt;
 
     // Extract output filename
@@ -107,20 +114,34 @@ static long init_record(struct aoRecord *prec)
         pstr++;
     }
 
-    const size_t fsize = strlen(pstr) + 1;
-    //if (fsize > MAX_INSTIO_STRING) {
-    //    errlogPrintf("%s (devTextFileAo): INP field is too long\n", prec->name);
-    //    return -1;
-    //}
-    dpvt->name = callocMustSucceed(1, fsize, "calloc for filename failed");
-    strcpy(dpvt->name, pstr);
+    // records referring to the same file share the name
+    dpvt->name = devTextFileIntern(pstr);
+
+    // Configure options from info tags
+    if (devTextFileConfig((dbCommon *)prec, dpvt) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
+
+    // Prepare header for npy format
+    if (dpvt->format == kNpy) {
+        if (devTextFileNpyInit((dbCommon *)prec, DBF_DOUBLE, -1) < 0) {
+            prec->pact = 1;
+            return -1;
+        }
+    }
 
     //
     if (dpvt->flag == kRead) {
         const char *filename = pstr;
 
         //
-        long ret = devTextFileRead(filename, &prec->val, (dbCommon *)prec, DBF_DOUBLE, 1, devTextFileAoDebug);
+        long ret;
+        if (dpvt->format == kNpy) {
+            ret = devTextFileNpyRead(filename, &prec->val, (dbCommon *)prec, DBF_DOUBLE, 1, devTextFileAoDebug);
+        } else {
+            ret = devTextFileRead(filename, &prec->val, (dbCommon *)prec, DBF_DOUBLE, 1, devTextFileAoDebug);
+        }
 
         //
         if (ret < 0) {
@@ -144,11 +165,84 @@ static long write_ao(struct aoRecord *prec)
         printf("%s (devTextFileAo): filename: %s\n", prec->name, filename);
     }
 
+    // shared memory: published to readers without system calls
+    if (dpvt->shm) {
+        double val = prec->val;
+
+        // Apply ASLO & AOFF
+        val -= prec->aoff;
+        if (prec->aslo != 0.0) {
+            val /= prec->aslo;
+        }
+
+        TRACE_BEGIN(prec, kTraceWrite);
+        long ret = devTextFileShmWrite((dbCommon *)prec, &val, DBF_DOUBLE, 1, 1, devTextFileAoDebug);
+        TRACE_END(prec, kTraceWrite);
+
+        //
+        prec->udf = FALSE;
+
+        //
+        return ret;
+    }
+
+    // npy format: header built in init_record followed by raw binary value
+    if (dpvt->format == kNpy) {
+        double val = prec->val;
+
+        // Apply ASLO & AOFF
+        val -= prec->aoff;
+        if (prec->aslo != 0.0) {
+            val /= prec->aslo;
+        }
+
+        TRACE_BEGIN(prec, kTraceWrite);
+        long ret = devTextFileNpyWrite(filename, &val, (dbCommon *)prec, DBF_DOUBLE, 1, devTextFileAoDebug);
+        TRACE_END(prec, kTraceWrite);
+        devTextFileCacheInvalidate(dpvt);
+
+        //
+        prec->udf = FALSE;
+
+        //
+        return ret;
+    }
+
+    // fixed-width fields overwritten by a single pwrite(), see TextFile:INPLACE
+    if (dpvt->inplace) {
+        double val = prec->val;
+
+        // Apply ASLO & AOFF
+        val -= prec->aoff;
+        if (prec->aslo != 0.0) {
+            val /= prec->aslo;
+        }
+
+        char text[32];
+        snprintf(text, sizeof(text), "%.17lg", val);
+
+        TRACE_BEGIN(prec, kTraceWrite);
+        long ret = devTextFileInplaceWrite((dbCommon *)prec, "devTextFileAo", text, val, devTextFileAoDebug);
+        TRACE_END(prec, kTraceWrite);
+
+        //
+        prec->udf = FALSE;
+
+        //
+        return ret;
+    }
+
     //
-    FILE *fp = fopen(filename, "w");
+    TRACE_BEGIN(prec, kTraceOpen);
+    FILE *fp = devTextFileFopen(dpvt, "w");
+    const int err = errno;
+    TRACE_END(prec, kTraceOpen);
     if (fp == NULL) {
-        char *errmsg = strerror_r(errno, dpvt->errmsg, ERRBUF); // GNU-specific version is assumed
+        devTextFileCacheInvalidate(dpvt);
+        TRACE_BEGIN(prec, kTraceErrlog);
+        const char *errmsg = devTextFileStrerror(err);
         errlogPrintf("%s (devTextFileAo): can't open \"%s\" for writing: %s\n", prec->name, filename, errmsg);
+        TRACE_END(prec, kTraceErrlog);
         prec->nsev = INVALID_ALARM;
         prec->nsta = WRITE_ACCESS_ALARM;
         return -1;
@@ -156,6 +250,7 @@ static long write_ao(struct aoRecord *prec)
 
     //
     int retval = 0;
+    TRACE_BEGIN(prec, kTraceWrite);
 
     // timestamp
     char datetime[128];
@@ -184,26 +279,38 @@ static long write_ao(struct aoRecord *prec)
     }
 
     //
+    char text[32];
+    snprintf(text, sizeof(text), "%.17lg", val);
+
     const int ret = fprintf(fp,
-                            "# saved by devTextFileAo on %s\n# %s as of %s.%06d %s\n%.17lg\n",
+                            "# saved by devTextFileAo on %s\n# %s as of %s.%06d %s\n%s\n",
                             buf.nodename,
                             prec->name, datetime, prec->time.nsec/1000, wday,
-                            val);
+                            text);
 
     if (ret < 0) {
         // write error
+        TRACE_BEGIN(prec, kTraceErrlog);
         errlogPrintf("%s (devTextFileAo): No data was written to the file: \"%s\"\n", prec->name, filename);
+        TRACE_END(prec, kTraceErrlog);
         prec->nsev = INVALID_ALARM;
         prec->nsta = WRITE_ALARM;
         retval = -1;
+        devTextFileCacheInvalidate(dpvt);
+    } else {
+        // publish to input records of the same file
+        devTextFileCachePublish(dpvt, fp, text, val);
     }
+    TRACE_END(prec, kTraceWrite);
 
     //
     prec->udf = FALSE;
 
     // cleanup
+    TRACE_BEGIN(prec, kTraceClose);
     fclose(fp);
     fp = NULL;
+    TRACE_END(prec, kTraceClose);
 
     //
     return retval;
@@ -0,0 +1,677 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "dbScan.h"
+#include "errlog.h"
+#include "epicsAtomic.h"
+#include "epicsEvent.h"
+#include "epicsExport.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "epicsThreadPool.h"
+#include "epicsTime.h"
+
+//
+#include "devTextFile.h"
+
+// number of worker threads for batched reads without io_uring
+static int devTextFileBatchThreads = 4;
+
+// initial size of read buffer for each record
+#define BATCH_BUFSIZ 4096
+
+// number of entries of io_uring submission queue
+#define URING_DEPTH 256
+
+// number of times files of a read group are read again when any of them changed
+#define GROUP_RETRIES 3
+
+// slice of members read by a worker thread
+typedef struct {
+    TextFileBatch_t *batch;
+    epicsJob        *job;
+    int              begin;
+    int              end;
+} slice_t;
+
+// contents of the file of a record read by the batch read, attached to TextFile_t
+struct TextFileMember {
+    char           *buf;        // contents read by the latest batch read, guarded by batch lock
+    size_t          siz;
+    size_t          len;
+    int             err;        // errno of the latest batch read
+    int             fd;
+    bool            fresh;      // buf has not been taken yet
+    uint32_t        nread;      // number of the batch read which filled buf
+    bool            stale;      // files of the read group kept changing during the latest read
+    ino_t           ino;        // inode and modification time of the file when it was read
+    struct timespec mtime;
+    char           *readbuf;    // buffer taken from buf while parsing
+    size_t          readsiz;
+};
+
+// records sharing a scan period, or records of a read group, read together
+struct TextFileBatch {
+    ELLNODE          node;
+    const char      *group;     // name of read group, NULL for batch of a scan period
+    int              scan;
+    int              prio;
+    double           period;    // 0 if contents don't expire
+    epicsMutexId     lock;
+    TextFile_t     **members;
+    int              nmembers;
+    epicsTimeStamp   time;      // time of the latest batch read
+    uint32_t         nread;     // number of batch reads
+    uint32_t         nretry;    // number of group reads retried as files changed
+    uint32_t         nstale;    // number of group reads which files kept changing
+    bool             stale;     // files changed during the latest group read even after retries
+    slice_t         *slices;    // for worker threads
+    int              nslices;
+    int              nsliced;   // number of members split into slices
+    int              pending;   // number of slices being read
+    epicsEventId     done;
+#ifdef HAVE_LIBURING
+    struct io_uring  ring;
+    int              uring;     // 1 if ring is usable, -1 if not, 0 if not yet initialized
+#endif
+};
+
+//
+static ELLLIST batchList = ELLLIST_INIT;
+static epicsThreadPool *batchPool = NULL;
+static epicsThreadOnceId batchOnce = EPICS_THREAD_ONCE_INIT;
+
+//
+static void batchInit(void *arg)
+{
+    epicsThreadPoolConfig config;
+    epicsThreadPoolConfigDefaults(&config);
+    config.maxThreads = devTextFileThreads();
+    batchPool = epicsThreadPoolGetShared(&config);
+}
+
+// Thread pool for reading files in parallel, shared with devTextFileGlob.c
+epicsThreadPool *devTextFileThreadPool(void)
+{
+    epicsThreadOnce(&batchOnce, batchInit, NULL);
+    return batchPool;
+}
+
+int devTextFileThreads(void)
+{
+    return (devTextFileBatchThreads > 0) ? devTextFileBatchThreads : 1;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read rest of the file from m->len into buffer, growing it as needed
+//
+static void readRest(TextFile_t *dpvt, int fd)
+{
+    TextFileMember_t *m = dpvt->member;
+    const size_t maxbytes = devTextFileByteLimit(dpvt);
+
+    while (true) {
+        if (m->len == m->siz) {
+            // one more byte than the limit, so that devTextFileParse() can tell that the limit was reached
+            if (maxbytes > 0 && m->siz > maxbytes) {
+                break;
+            }
+            size_t size = m->siz * 2;
+            if (maxbytes > 0 && size > maxbytes + 1) {
+                size = maxbytes + 1;
+            }
+            m->buf = realloc(m->buf, size);
+            if (m->buf == NULL) {
+                cantProceed("realloc for batch buffer failed");
+            }
+            m->siz = size;
+        }
+
+        ssize_t ret = pread(fd, m->buf + m->len, m->siz - m->len, m->len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            m->err = errno;
+            break;
+        }
+        if (ret == 0) {
+            break;
+        }
+        m->len += ret;
+    }
+}
+
+//
+static void allocBuffer(TextFile_t *dpvt)
+{
+    TextFileMember_t *m = dpvt->member;
+
+    if (m->buf == NULL) {
+        m->siz = BATCH_BUFSIZ;
+        m->buf = mallocMustSucceed(m->siz, "malloc for batch buffer failed");
+    }
+    m->nread = dpvt->batch->nread + 1; // batch->nread is counted after the read
+    m->len = 0;
+    m->err = 0;
+    m->ino = 0;
+    m->mtime.tv_sec = 0;
+    m->mtime.tv_nsec = 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Worker thread: open, read and close files of a slice of members
+//
+static void readSlice(void *arg, epicsJobMode mode)
+{
+    slice_t *slice = arg;
+    TextFileBatch_t *batch = slice->batch;
+
+    if (mode == epicsJobModeRun) {
+        for (int i = slice->begin; i < slice->end; i++) {
+            TextFile_t *dpvt = batch->members[i];
+            TextFileMember_t *m = dpvt->member;
+
+            allocBuffer(dpvt);
+
+            int fd = devTextFileOpen(dpvt, O_RDONLY, 0);
+            if (fd < 0) {
+                m->err = errno;
+                continue;
+            }
+
+            // identity of the contents, also used for TSE=-2 and TextFile:FRESHNESS
+            struct stat st;
+            if (fstat(fd, &st) == 0) {
+                m->ino = st.st_ino;
+                m->mtime = st.st_mtim;
+            }
+            readRest(dpvt, fd);
+            close(fd);
+        }
+    }
+
+    // batch->lock is held by the thread waiting for the slices
+    if (epicsAtomicDecrIntT(&batch->pending) == 0) {
+        epicsEventMustTrigger(batch->done);
+    }
+}
+
+//
+static void readThreads(TextFileBatch_t *batch)
+{
+    // split members into slices again if records joined after the last split,
+    // e.g. when the first batch read is done by init_record of an earlier member
+    if (batch->slices && batch->nsliced != batch->nmembers) {
+        for (int i = 0; i < batch->nslices; i++) {
+            epicsJobDestroy(batch->slices[i].job);
+        }
+        free(batch->slices);
+        batch->slices = NULL;
+    }
+
+    //
+    if (batch->slices == NULL) {
+        epicsThreadPool *pool = devTextFileThreadPool();
+
+        batch->nslices = devTextFileThreads();
+        if (batch->nslices > batch->nmembers) {
+            batch->nslices = batch->nmembers;
+        }
+        batch->slices = devTextFileCalloc(batch->nslices, sizeof(slice_t), "calloc for batch slices failed");
+        for (int i = 0; i < batch->nslices; i++) {
+            slice_t *slice = &batch->slices[i];
+            slice->batch = batch;
+            slice->begin = (int64_t)batch->nmembers * i / batch->nslices;
+            slice->end = (int64_t)batch->nmembers * (i + 1) / batch->nslices;
+            slice->job = epicsJobCreate(pool, readSlice, slice);
+            if (slice->job == NULL) {
+                cantProceed("epicsJobCreate for batch read failed");
+            }
+        }
+        batch->nsliced = batch->nmembers;
+        if (batch->done == NULL) {
+            batch->done = epicsEventMustCreate(epicsEventEmpty);
+        }
+    }
+
+    //
+    epicsAtomicSetIntT(&batch->pending, batch->nslices);
+    for (int i = 0; i < batch->nslices; i++) {
+        if (epicsJobQueue(batch->slices[i].job) != 0) {
+            readSlice(&batch->slices[i], epicsJobModeRun); // read in this thread
+        }
+    }
+    epicsEventMustWait(batch->done);
+}
+
+#ifdef HAVE_LIBURING
+/////////////////////////////////////////////////////////////////
+//
+// io_uring: open, read and close files of all members in a few submissions
+//
+static int initUring(TextFileBatch_t *batch)
+{
+    if (batch->uring != 0) {
+        return batch->uring;
+    }
+
+    batch->uring = -1;
+    if (io_uring_queue_init(URING_DEPTH, &batch->ring, 0) < 0) {
+        return -1;
+    }
+
+    struct io_uring_probe *probe = io_uring_get_probe_ring(&batch->ring);
+    if (probe &&
+        io_uring_opcode_supported(probe, IORING_OP_OPENAT) &&
+        io_uring_opcode_supported(probe, IORING_OP_READ) &&
+        io_uring_opcode_supported(probe, IORING_OP_CLOSE)) {
+        batch->uring = 1;
+    } else {
+        io_uring_queue_exit(&batch->ring);
+    }
+    if (probe) {
+        io_uring_free_probe(probe);
+    }
+
+    return batch->uring;
+}
+
+// submit queued entries and reap count completions
+static void reap(TextFileBatch_t *batch, int count, int op)
+{
+    io_uring_submit_and_wait(&batch->ring, count);
+
+    for (int i = 0; i < count; i++) {
+        struct io_uring_cqe *cqe;
+        if (io_uring_wait_cqe(&batch->ring, &cqe) < 0) {
+            break;
+        }
+
+        TextFileMember_t *m = io_uring_cqe_get_data(cqe);
+        if (op == IORING_OP_OPENAT) {
+            if (cqe->res < 0) {
+                m->err = -cqe->res;
+                m->fd = -1;
+            } else {
+                m->fd = cqe->res;
+            }
+        } else if (op == IORING_OP_READ) {
+            if (cqe->res < 0) {
+                m->err = -cqe->res;
+            } else {
+                m->len = cqe->res;
+            }
+        }
+        io_uring_cqe_seen(&batch->ring, cqe);
+    }
+}
+
+static int readUring(TextFileBatch_t *batch)
+{
+    if (initUring(batch) < 0) {
+        return -1;
+    }
+
+    for (int base = 0; base < batch->nmembers; base += URING_DEPTH) {
+        const int count = (batch->nmembers - base < URING_DEPTH) ? batch->nmembers - base : URING_DEPTH;
+        TextFile_t **members = batch->members + base;
+        int nopen = 0;
+
+        // open
+        for (int i = 0; i < count; i++) {
+            allocBuffer(members[i]);
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&batch->ring);
+            const char *name;
+            const int dirfd = devTextFileDirFd(members[i], &name);
+            io_uring_prep_openat(sqe, dirfd, name, O_RDONLY | O_CLOEXEC, 0);
+            io_uring_sqe_set_data(sqe, members[i]->member);
+        }
+        reap(batch, count, IORING_OP_OPENAT);
+
+        // read as much as the buffer holds
+        for (int i = 0; i < count; i++) {
+            if (members[i]->member->fd >= 0) {
+                struct io_uring_sqe *sqe = io_uring_get_sqe(&batch->ring);
+                io_uring_prep_read(sqe, members[i]->member->fd, members[i]->member->buf, members[i]->member->siz, 0);
+                io_uring_sqe_set_data(sqe, members[i]->member);
+                nopen ++;
+            }
+        }
+        reap(batch, nopen, IORING_OP_READ);
+
+        // files larger than the buffer, which grows for the next time
+        for (int i = 0; i < count; i++) {
+            if (members[i]->member->fd >= 0 && members[i]->member->err == 0 && members[i]->member->len == members[i]->member->siz) {
+                readRest(members[i], members[i]->member->fd);
+            }
+        }
+
+        // close
+        for (int i = 0; i < count; i++) {
+            if (members[i]->member->fd >= 0) {
+                struct io_uring_sqe *sqe = io_uring_get_sqe(&batch->ring);
+                io_uring_prep_close(sqe, members[i]->member->fd);
+                io_uring_sqe_set_data(sqe, members[i]->member);
+                members[i]->member->fd = -1;
+            }
+        }
+        reap(batch, nopen, IORING_OP_CLOSE);
+    }
+
+    return 0;
+}
+#endif
+
+// check if any file of the group has been replaced or modified since it was read
+static bool groupChanged(TextFileBatch_t *batch)
+{
+    for (int i = 0; i < batch->nmembers; i++) {
+        TextFile_t *dpvt = batch->members[i];
+        TextFileMember_t *m = dpvt->member;
+        struct stat st;
+
+        // not read at all, e.g. joined after the members were split into slices
+        if (m->nread != batch->nread + 1) {
+            return true;
+        }
+        if (m->err != 0) {
+            continue;
+        }
+        if (devTextFileStat(dpvt, &st) != 0 ||
+            st.st_ino != m->ino ||
+            st.st_mtim.tv_sec != m->mtime.tv_sec ||
+            st.st_mtim.tv_nsec != m->mtime.tv_nsec) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read files of all members, called with batch->lock held. Files of a read
+// group are read again if any of them changed meanwhile.
+//
+static void batchRead(TextFileBatch_t *batch)
+{
+    for (int retry = 0; ; retry++) {
+#ifdef HAVE_LIBURING
+        // inode and modification time are taken only by worker threads
+        if (batch->group || readUring(batch) < 0) {
+            readThreads(batch);
+        }
+#else
+        readThreads(batch);
+#endif
+
+        if (batch->group == NULL || !groupChanged(batch)) {
+            batch->stale = false;
+            break;
+        }
+        if (retry == GROUP_RETRIES) {
+            if (!batch->stale) {
+                errlogPrintf("devTextFileBatch: files of read group \"%s\" changed while being read %d times\n", batch->group, GROUP_RETRIES + 1);
+            }
+            batch->stale = true;
+            batch->nstale ++;
+            break;
+        }
+        batch->nretry ++;
+    }
+
+    //
+    epicsTimeGetCurrent(&batch->time);
+    batch->nread ++;
+
+    for (int i = 0; i < batch->nmembers; i++) {
+        batch->members[i]->member->fresh = true;
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Join the batch of records with the same SCAN and PRIO
+//
+static void join(TextFileBatch_t *batch, TextFile_t *dpvt)
+{
+    TextFile_t **members = realloc(batch->members, (batch->nmembers + 1) * sizeof(TextFile_t *));
+    if (members == NULL) {
+        cantProceed("realloc for batch members failed");
+    }
+    batch->members = members;
+    batch->members[batch->nmembers++] = dpvt;
+
+    dpvt->batch = batch;
+    dpvt->member = devTextFileCalloc(1, sizeof(TextFileMember_t), "calloc for batch member failed");
+    dpvt->member->fd = -1;
+}
+
+//
+long devTextFileBatchJoin(dbCommon *prec, TextFile_t *dpvt)
+{
+    if (prec->scan < SCAN_1ST_PERIODIC) {
+        errlogPrintf("%s (%s): TextFile:BATCH requires periodic SCAN\n", prec->name, __func__);
+        return -1;
+    }
+
+    //
+    TextFileBatch_t *batch = NULL;
+    for (ELLNODE *node = ellFirst(&batchList); node; node = ellNext(node)) {
+        TextFileBatch_t *p = (TextFileBatch_t *)node;
+        if (p->group == NULL && p->scan == prec->scan && p->prio == prec->prio) {
+            batch = p;
+            break;
+        }
+    }
+
+    if (batch == NULL) {
+        batch = devTextFileCalloc(1, sizeof(TextFileBatch_t), "calloc for batch failed");
+        batch->scan = prec->scan;
+        batch->prio = prec->prio;
+        batch->period = scanPeriod(prec->scan);
+        batch->lock = epicsMutexMustCreate();
+        ellAdd(&batchList, &batch->node);
+    }
+
+    //
+    join(batch, dpvt);
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Join the read group of the name given by info tag TextFile:GROUP. Contents
+// expire after the shortest scan period of the members, or never if none is periodic.
+//
+long devTextFileGroupJoin(dbCommon *prec, TextFile_t *dpvt, const char *name)
+{
+    if (dpvt->batch) {
+        errlogPrintf("%s (%s): TextFile:GROUP can't be used with TextFile:BATCH\n", prec->name, __func__);
+        return -1;
+    }
+
+    //
+    TextFileBatch_t *batch = NULL;
+    for (ELLNODE *node = ellFirst(&batchList); node; node = ellNext(node)) {
+        TextFileBatch_t *p = (TextFileBatch_t *)node;
+        if (p->group && strcmp(p->group, name) == 0) {
+            batch = p;
+            break;
+        }
+    }
+
+    if (batch == NULL) {
+        batch = devTextFileCalloc(1, sizeof(TextFileBatch_t), "calloc for read group failed");
+        batch->group = devTextFileIntern(name);
+        batch->lock = epicsMutexMustCreate();
+        ellAdd(&batchList, &batch->node);
+    }
+
+    if (prec->scan >= SCAN_1ST_PERIODIC) {
+        const double period = scanPeriod(prec->scan);
+        if (batch->period == 0 || period < batch->period) {
+            batch->period = period;
+        }
+    }
+
+    //
+    join(batch, dpvt);
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Open contents of the file read by the latest batch read. A new batch read is
+// done for all members if the contents was already taken or is older than the
+// scan period. Returns NULL with errno set if the file couldn't be read.
+//
+FILE *devTextFileBatchOpen(dbCommon *prec)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileBatch_t *batch = dpvt->batch;
+    TextFileMember_t *m = dpvt->member;
+
+    epicsMutexMustLock(batch->lock);
+
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    if (!m->fresh || m->buf == NULL || m->nread != batch->nread || (batch->period > 0 && epicsTimeDiffInSeconds(&now, &batch->time) >= batch->period)) {
+        batchRead(batch);
+    }
+    m->fresh = false;
+    m->stale = batch->stale;
+
+    // every member has to be read by the read which gives the time shared by the group
+    if (m->nread != batch->nread) {
+        epicsMutexUnlock(batch->lock);
+        errno = EIO;
+        return NULL;
+    }
+
+    if (m->err != 0) {
+        const int err = m->err;
+        epicsMutexUnlock(batch->lock);
+        errno = err;
+        return NULL;
+    }
+
+    // modification time for TSE=-2 and TextFile:FRESHNESS, taken by the batch read
+    if (dpvt->age || prec->tse == epicsTimeEventDeviceTime) {
+        if (m->mtime.tv_sec != 0 || m->mtime.tv_nsec != 0) {
+            devTextFileFreshTime(prec, &m->mtime);
+        } else {
+            devTextFileFresh(prec, -1); // read by io_uring
+        }
+    }
+
+    // members of a read group share the time of the group read
+    if (batch->group && prec->tse == epicsTimeEventDeviceTime) {
+        prec->time = batch->time;
+    }
+
+    // take the buffer, so that it is not overwritten by batch read from other thread while parsing
+    char *buf = m->readbuf = m->buf;
+    size_t len = m->len;
+    m->readsiz = m->siz;
+    m->buf = NULL;
+
+    epicsMutexUnlock(batch->lock);
+
+    //
+    if (len == 0) {
+        return fopen("/dev/null", "r");
+    }
+    return fmemopen(buf, len, "r");
+}
+
+// give back the buffer taken by devTextFileBatchOpen()
+void devTextFileBatchClose(dbCommon *prec)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileBatch_t *batch = dpvt->batch;
+    TextFileMember_t *m = dpvt->member;
+
+    epicsMutexMustLock(batch->lock);
+    if (m->buf == NULL) {
+        m->buf = m->readbuf;
+        m->siz = m->readsiz;
+    } else {
+        free(m->readbuf);
+    }
+    m->readbuf = NULL;
+    epicsMutexUnlock(batch->lock);
+}
+
+// files of the read group kept changing during the read taken by devTextFileBatchOpen()
+bool devTextFileBatchStale(const TextFile_t *dpvt)
+{
+    return dpvt->member->stale;
+}
+
+// bytes of buffers of the record, for devTextFileMemReport()
+size_t devTextFileBatchMemory(const TextFile_t *dpvt)
+{
+    const TextFileMember_t *m = dpvt->member;
+
+    return sizeof(TextFileMember_t) + (m->buf ? m->siz : 0) + (m->readbuf ? m->readsiz : 0);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report the batch of the record, called from devTextFileReport()
+//
+void devTextFileBatchReport(const TextFile_t *dpvt)
+{
+    const TextFileBatch_t *batch = dpvt->batch;
+
+    if (batch->group) {
+        printf("        read group \"%s\": %d record(s), %u read(s), %u retried, %u with files changing\n", batch->group, batch->nmembers, batch->nread, batch->nretry, batch->nstale);
+        return;
+    }
+    printf("        batch of %g second(s), priority %d: %d record(s), %u read(s)\n", batch->period, batch->prio, batch->nmembers, batch->nread);
+}
+
+// Register symbol(s) used by IOC core
+epicsExportAddress(int, devTextFileBatchThreads);
+
+// end
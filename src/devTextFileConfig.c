@@ -0,0 +1,416 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+//
+#include "dbAccess.h"
+#include "dbBase.h"
+#include "dbCommon.h"
+#include "dbStaticLib.h"
+#include "drvSup.h"
+#include "ellLib.h"
+#include "errlog.h"
+#include "epicsExport.h"
+
+//
+#include "devTextFile.h"
+
+// all records using devTextFile
+static ELLLIST recordList = ELLLIST_INIT;
+
+/////////////////////////////////////////////////////////////////
+//
+// Look up info tag of the record, returns NULL if not defined
+//
+const char *devTextFileGetInfo(dbCommon *prec, const char *name)
+{
+    DBENTRY dbentry;
+    const char *value = NULL;
+
+    dbInitEntry(pdbbase, &dbentry);
+    if (dbFindRecord(&dbentry, prec->name) == 0) {
+        value = dbGetInfo(&dbentry, name);
+    }
+    dbFinishEntry(&dbentry);
+
+    return value;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Parse info tag as floating point number.
+// Returns 1 if defined, 0 if not defined and -1 on parse error.
+//
+static int getInfoDouble(dbCommon *prec, const char *name, double *val)
+{
+    const char *value = devTextFileGetInfo(prec, name);
+    if (value == NULL) {
+        return 0;
+    }
+
+    char *endptr;
+    *val = strtod(value, &endptr);
+    if (endptr == value || *endptr != 0) {
+        errlogPrintf("%s (devTextFileConfig): invalid %s \"%s\"\n", prec->name, name, value);
+        return -1;
+    }
+
+    return 1;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Configure per-record options from info tags
+//
+long devTextFileConfig(dbCommon *prec, TextFile_t *dpvt)
+{
+    const char *value;
+
+    //
+    dpvt->prec = prec;
+    ellAdd(&recordList, &dpvt->node);
+
+    // records referring to the same file share the entry
+    dpvt->entry = devTextFileEntryGet(dpvt->name);
+    dpvt->ioscanpvt = (dpvt->stat != kStatNone) ? dpvt->entry->statscan : dpvt->entry->ioscanpvt;
+
+    // records in the same directory share its descriptor
+    devTextFileDirInit(dpvt);
+    if (dpvt->stat != kStatNone) {
+        epicsMutexMustLock(dpvt->entry->lock);
+        dpvt->entry->nstats++;
+        epicsMutexUnlock(dpvt->entry->lock);
+    }
+
+    // file format
+    value = devTextFileGetInfo(prec, "TextFile:FORMAT");
+    if (value == NULL || strcasecmp(value, "text") == 0) {
+        dpvt->format = kText;
+    } else if (strcasecmp(value, "npy") == 0) {
+        dpvt->format = kNpy;
+    } else {
+        errlogPrintf("%s (%s): unknown TextFile:FORMAT \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+
+    // decimation for waveform
+    value = devTextFileGetInfo(prec, "TextFile:DECIMATE");
+    if (value == NULL || strcasecmp(value, "none") == 0) {
+        dpvt->decimate = kDecimNone;
+    } else if (strcasecmp(value, "stride") == 0) {
+        dpvt->decimate = kDecimStride;
+    } else if (strcasecmp(value, "mean") == 0) {
+        dpvt->decimate = kDecimMean;
+    } else if (strcasecmp(value, "minmax") == 0) {
+        dpvt->decimate = kDecimMinMax;
+    } else {
+        errlogPrintf("%s (%s): unknown TextFile:DECIMATE \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+    if (dpvt->decimate != kDecimNone && strcmp(prec->rdes->name, "waveform") != 0) {
+        errlogPrintf("%s (%s): TextFile:DECIMATE can be used only with waveform\n", prec->name, __func__);
+        return -1;
+    }
+
+    // limits of line length and bytes per read
+    double maxline = 0;
+    double maxbytes = 0;
+    if (getInfoDouble(prec, "TextFile:MAXLINE", &maxline) < 0 || getInfoDouble(prec, "TextFile:MAXBYTES", &maxbytes) < 0) {
+        return -1;
+    }
+    if (maxline < 0 || maxbytes < 0) {
+        errlogPrintf("%s (%s): TextFile:MAXLINE and TextFile:MAXBYTES must not be negative\n", prec->name, __func__);
+        return -1;
+    }
+    dpvt->maxline = maxline;
+    dpvt->maxbytes = maxbytes;
+
+    // linear conversion and smoothing for waveform
+    int aslo = getInfoDouble(prec, "TextFile:ASLO", &dpvt->aslo);
+    int aoff = getInfoDouble(prec, "TextFile:AOFF", &dpvt->aoff);
+    int smoo = getInfoDouble(prec, "TextFile:SMOO", &dpvt->smoo);
+    if (aslo < 0 || aoff < 0 || smoo < 0) {
+        return -1;
+    }
+    if (aslo == 0 || dpvt->aslo == 0.0) {
+        dpvt->aslo = 1.0;
+    }
+    if (smoo > 0 && (dpvt->smoo < 0.0 || dpvt->smoo >= 1.0)) {
+        errlogPrintf("%s (%s): TextFile:SMOO must be in range [0, 1)\n", prec->name, __func__);
+        return -1;
+    }
+    dpvt->linconv = (aslo > 0 || aoff > 0 || smoo > 0);
+
+    // read together with other records of the same scan period
+    value = devTextFileGetInfo(prec, "TextFile:BATCH");
+    if (value && strcasecmp(value, "YES") == 0) {
+        if (devTextFileBatchJoin(prec, dpvt) != 0) {
+            return -1;
+        }
+    } else if (value && strcasecmp(value, "NO") != 0) {
+        errlogPrintf("%s (%s): unknown TextFile:BATCH \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+
+    // read together with other records of the group as a consistent set
+    value = devTextFileGetInfo(prec, "TextFile:GROUP");
+    if (value && devTextFileGroupJoin(prec, dpvt, value) != 0) {
+        return -1;
+    }
+
+    // pseudo-file of sysfs/procfs, also processed with SCAN="I/O Intr" on sysfs_notify()
+    value = devTextFileGetInfo(prec, "TextFile:SYSFS");
+    if (value && strcasecmp(value, "YES") == 0) {
+        if (dpvt->batch) {
+            errlogPrintf("%s (%s): TextFile:SYSFS can't be used with TextFile:BATCH or TextFile:GROUP\n", prec->name, __func__);
+            return -1;
+        }
+        devTextFileSysfsInit(prec, dpvt);
+        dpvt->ioscanpvt = dpvt->entry->pollscan;
+    } else if (value && strcasecmp(value, "NO") != 0) {
+        errlogPrintf("%s (%s): unknown TextFile:SYSFS \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+
+    // read and decoded in background, records only copy the latest contents
+    double period = 0;
+    int refresh = getInfoDouble(prec, "TextFile:REFRESH", &period);
+    if (refresh < 0) {
+        return -1;
+    }
+    if (refresh > 0 && devTextFileRefreshInit(prec, dpvt, period) != 0) {
+        return -1;
+    }
+
+    // large file parsed by a pool of threads
+    value = devTextFileGetInfo(prec, "TextFile:PARALLEL");
+    if (value && strcasecmp(value, "YES") == 0) {
+        if (devTextFileParallelInit(prec, dpvt) != 0) {
+            return -1;
+        }
+    } else if (value && strcasecmp(value, "NO") != 0) {
+        errlogPrintf("%s (%s): unknown TextFile:PARALLEL \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+
+    // contents checked against the trailer line
+    value = devTextFileGetInfo(prec, "TextFile:CRC");
+    if (value && strcasecmp(value, "YES") == 0) {
+        if (devTextFileCrcInit(prec, dpvt) != 0) {
+            return -1;
+        }
+    } else if (value && strcasecmp(value, "NO") != 0) {
+        errlogPrintf("%s (%s): unknown TextFile:CRC \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+
+    // histogram of age of the contents
+    value = devTextFileGetInfo(prec, "TextFile:FRESHNESS");
+    if (value && strcasecmp(value, "YES") == 0) {
+        devTextFileFreshInit(dpvt);
+    } else if (value && strcasecmp(value, "NO") != 0) {
+        errlogPrintf("%s (%s): unknown TextFile:FRESHNESS \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+
+    // process with SCAN="I/O Intr" when the file is changed
+    value = devTextFileGetInfo(prec, "TextFile:POLL");
+    if (value && strcasecmp(value, "YES") == 0) {
+        dpvt->poll = true;
+        dpvt->ioscanpvt = dpvt->entry->pollscan;
+    } else if (value && strcasecmp(value, "NO") != 0) {
+        errlogPrintf("%s (%s): unknown TextFile:POLL \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+
+    // values pushed through FIFO or Unix domain socket, processed with SCAN="I/O Intr"
+    value = devTextFileGetInfo(prec, "TextFile:STREAM");
+    if (value && strcasecmp(value, "YES") == 0) {
+        if (devTextFileStreamInit(prec, dpvt) != 0) {
+            return -1;
+        }
+    } else if (value && strcasecmp(value, "NO") != 0) {
+        errlogPrintf("%s (%s): unknown TextFile:STREAM \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+
+    // values exchanged through POSIX shared memory instead of file
+    value = devTextFileGetInfo(prec, "TextFile:SHM");
+    if (value && strcasecmp(value, "YES") == 0) {
+        if (devTextFileShmInit(prec, dpvt) != 0) {
+            return -1;
+        }
+    } else if (value && strcasecmp(value, "NO") != 0) {
+        errlogPrintf("%s (%s): unknown TextFile:SHM \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+
+    // output file kept open, and the value overwritten in place
+    value = devTextFileGetInfo(prec, "TextFile:INPLACE");
+    if (value && strcasecmp(value, "YES") == 0) {
+        if (devTextFileInplaceInit(prec, dpvt) != 0) {
+            return -1;
+        }
+    } else if (value && strcasecmp(value, "NO") != 0) {
+        errlogPrintf("%s (%s): unknown TextFile:INPLACE \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+
+    // parsed values of large file kept in binary form for the next start of IOC
+    value = devTextFileGetInfo(prec, "TextFile:SIDECAR");
+    if (value && strcasecmp(value, "YES") == 0) {
+        if (devTextFileSidecarInit(prec, dpvt) != 0) {
+            return -1;
+        }
+    } else if (value && strcasecmp(value, "NO") != 0) {
+        errlogPrintf("%s (%s): unknown TextFile:SIDECAR \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+
+    // page cache policy of large files, and prefetch before the next scan
+    const char *advise = devTextFileGetInfo(prec, "TextFile:ADVISE");
+    value = devTextFileGetInfo(prec, "TextFile:PREFETCH");
+    if (value && strcasecmp(value, "YES") != 0 && strcasecmp(value, "NO") != 0) {
+        errlogPrintf("%s (%s): unknown TextFile:PREFETCH \"%s\"\n", prec->name, __func__, value);
+        return -1;
+    }
+    const bool prefetch = value && strcasecmp(value, "YES") == 0;
+    if (advise || prefetch) {
+        if (devTextFileAdviseInit(prec, dpvt, advise, prefetch) != 0) {
+            return -1;
+        }
+    }
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report records of the device support, called from dbior
+//
+long devTextFileReport(int level, const void *pdset)
+{
+    int count = 0;
+
+    for (ELLNODE *node = ellFirst(&recordList); node; node = ellNext(node)) {
+        TextFile_t *dpvt = (TextFile_t *)node;
+        dbCommon *prec = dpvt->prec;
+
+        if ((const void *)prec->dset != pdset) {
+            continue;
+        }
+        count ++;
+
+        if (level > 0) {
+            printf("    %s: \"%s\"\n", prec->name, dpvt->name);
+        }
+        if (level > 1) {
+            printf("        overlong lines: %u, reads stopped by maximum bytes: %u, reads from cache: %u\n", dpvt->noverlong, dpvt->ncapped, dpvt->ncached);
+            if (dpvt->entry->nskipped > 0) {
+                printf("        reads skipped while the file was missing or unreadable: %u\n", dpvt->entry->nskipped);
+            }
+            if (dpvt->batch) {
+                devTextFileBatchReport(dpvt);
+            }
+            if (dpvt->poll) {
+                devTextFilePollReport(dpvt);
+            }
+            if (dpvt->glob) {
+                devTextFileGlobReport(dpvt);
+            }
+            if (dpvt->age) {
+                devTextFileFreshReport(dpvt);
+            }
+            if (dpvt->refresh) {
+                devTextFileRefreshReport(dpvt);
+            }
+            if (dpvt->parallel) {
+                devTextFileParallelReport(dpvt);
+            }
+            if (dpvt->crc) {
+                devTextFileCrcReport(dpvt);
+            }
+            if (dpvt->stream) {
+                devTextFileStreamReport(dpvt);
+            }
+            if (dpvt->shm) {
+                devTextFileShmReport(dpvt);
+            }
+            if (dpvt->inplace) {
+                devTextFileInplaceReport(dpvt);
+            }
+            if (dpvt->sidecar) {
+                devTextFileSidecarReport(dpvt);
+            }
+            if (dpvt->advise) {
+                devTextFileAdviseReport(dpvt);
+            }
+        }
+    }
+
+    printf("    %d record(s)\n", count);
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Driver support only for dbior, so that memory and directories of all
+// records are reported once rather than by the report of each dset
+//
+static long drvReport(int level);
+
+struct {
+    long        number;
+    DRVSUPFUN   report;
+    DRVSUPFUN   init;
+} drvTextFile = {
+    2,
+    drvReport,
+    NULL
+};
+
+epicsExportAddress(drvet, drvTextFile);
+
+//
+static long drvReport(int level)
+{
+    // memory of all records, whichever device support they use
+    if (level > 0) {
+        size_t buffers = 0;
+        for (ELLNODE *node = ellFirst(&recordList); node; node = ellNext(node)) {
+            const TextFile_t *dpvt = (const TextFile_t *)node;
+            buffers += (dpvt->member ? devTextFileBatchMemory(dpvt) : 0) + (dpvt->sysfs ? devTextFileSysfsMemory(dpvt) : 0);
+        }
+        devTextFileMemReport(buffers);
+    }
+    if (level > 1) {
+        devTextFileDirReport();
+    }
+
+    //
+    return 0;
+}
+
+// end
@@ -0,0 +1,374 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+//
+#include "dbAccess.h"
+#include "dbCommon.h"
+
+//
+#include "devTextFile.h"
+
+//
+typedef struct {
+    double aslo;
+    double aoff;
+    double smoo;
+} conv_t;
+
+/////////////////////////////////////////////////////////////////
+//
+// Scalar kernels, same as ASLO/AOFF/SMOO handling of ai record
+//
+static inline double linconv1(double x, const conv_t *c)
+{
+    return x * c->aslo + c->aoff;
+}
+
+static inline double smooth1(double v, double prev, const conv_t *c)
+{
+    return isfinite(prev) ? v * (1.00 - c->smoo) + prev * c->smoo : v;
+}
+
+// round to nearest and saturate, NaN is mapped to the lower limit
+static inline double clamp1(double v, double lo, double hi)
+{
+    if (!(v >= lo)) {
+        v = lo;
+    }
+    if (v > hi) {
+        v = hi;
+    }
+    return v;
+}
+
+#if defined(__SSE2__)
+/////////////////////////////////////////////////////////////////
+//
+// SSE2 kernels processing two doubles at once
+//
+static inline __m128d linconv2(__m128d x, __m128d a, __m128d b)
+{
+    return _mm_add_pd(_mm_mul_pd(x, a), b);
+}
+
+static inline __m128d smooth2(__m128d v, __m128d prev, __m128d s, __m128d s1)
+{
+    __m128d sm = _mm_add_pd(_mm_mul_pd(v, s1), _mm_mul_pd(prev, s));
+    __m128d finite = _mm_cmpeq_pd(_mm_sub_pd(prev, prev), _mm_setzero_pd()); // false for NaN and Inf
+    return _mm_or_pd(_mm_and_pd(finite, sm), _mm_andnot_pd(finite, v));
+}
+
+// statistics of two lanes, reduced to TextFileStats_t after the loop
+typedef struct {
+    __m128d min;
+    __m128d max;
+    __m128d sum;
+    __m128d sumsq;
+} stats2_t;
+
+static inline void stats2Init(stats2_t *s)
+{
+    s->min   = _mm_set1_pd(INFINITY);
+    s->max   = _mm_set1_pd(-INFINITY);
+    s->sum   = _mm_setzero_pd();
+    s->sumsq = _mm_setzero_pd();
+}
+
+// min/max return the second operand for NaN, so NaN is skipped as devTextFileStatsAdd() does
+static inline void stats2Add(stats2_t *s, __m128d x)
+{
+    s->min   = _mm_min_pd(x, s->min);
+    s->max   = _mm_max_pd(x, s->max);
+    s->sum   = _mm_add_pd(s->sum, x);
+    s->sumsq = _mm_add_pd(s->sumsq, _mm_mul_pd(x, x));
+}
+
+static void stats2Reduce(TextFileStats_t *stats, const stats2_t *s, uint32_t count)
+{
+    double min[2], max[2], sum[2], sumsq[2];
+    _mm_storeu_pd(min, s->min);
+    _mm_storeu_pd(max, s->max);
+    _mm_storeu_pd(sum, s->sum);
+    _mm_storeu_pd(sumsq, s->sumsq);
+
+    const TextFileStats_t part = {
+        (min[0] < min[1]) ? min[0] : min[1],
+        (max[0] > max[1]) ? max[0] : max[1],
+        sum[0] + sum[1],
+        sumsq[0] + sumsq[1],
+        count,
+    };
+    devTextFileStatsMerge(stats, &part);
+}
+#endif
+
+/////////////////////////////////////////////////////////////////
+//
+// DOUBLE: val[begin:end] = val * aslo + aoff, smoothed with state if smooth is true
+//
+static void convertDouble(double *val, double *state, uint32_t begin, uint32_t end, const conv_t *c, bool smooth, TextFileStats_t *stats)
+{
+    uint32_t i = begin;
+
+#if defined(__SSE2__)
+    const __m128d a  = _mm_set1_pd(c->aslo);
+    const __m128d b  = _mm_set1_pd(c->aoff);
+    const __m128d s  = _mm_set1_pd(c->smoo);
+    const __m128d s1 = _mm_set1_pd(1.00 - c->smoo);
+    stats2_t st;
+    stats2Init(&st);
+
+    for (; i + 2 <= end; i += 2) {
+        __m128d v = linconv2(_mm_loadu_pd(val + i), a, b);
+        if (smooth) {
+            v = smooth2(v, _mm_loadu_pd(state + i), s, s1);
+        }
+        _mm_storeu_pd(val + i, v);
+        if (state) {
+            _mm_storeu_pd(state + i, v);
+        }
+        if (stats) {
+            stats2Add(&st, v);
+        }
+    }
+    if (stats) {
+        stats2Reduce(stats, &st, i - begin);
+    }
+#endif
+
+    for (; i < end; i++) {
+        double v = linconv1(val[i], c);
+        if (smooth) {
+            v = smooth1(v, state[i], c);
+        }
+        val[i] = v;
+        if (state) {
+            state[i] = v;
+        }
+        if (stats) {
+            devTextFileStatsAdd(stats, val[i]);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// FLOAT: computed in double precision as ai record does
+//
+static void convertFloat(float *val, double *state, uint32_t begin, uint32_t end, const conv_t *c, bool smooth, TextFileStats_t *stats)
+{
+    uint32_t i = begin;
+
+#if defined(__SSE2__)
+    const __m128d a  = _mm_set1_pd(c->aslo);
+    const __m128d b  = _mm_set1_pd(c->aoff);
+    const __m128d s  = _mm_set1_pd(c->smoo);
+    const __m128d s1 = _mm_set1_pd(1.00 - c->smoo);
+    stats2_t st;
+    stats2Init(&st);
+
+    for (; i + 2 <= end; i += 2) {
+        __m128d x = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double *)(val + i))));
+        __m128d v = linconv2(x, a, b);
+        if (smooth) {
+            v = smooth2(v, _mm_loadu_pd(state + i), s, s1);
+        }
+        const __m128 f = _mm_cvtpd_ps(v);
+        _mm_store_sd((double *)(val + i), _mm_castps_pd(f));
+        if (state) {
+            _mm_storeu_pd(state + i, v);
+        }
+        if (stats) {
+            stats2Add(&st, _mm_cvtps_pd(f));
+        }
+    }
+    if (stats) {
+        stats2Reduce(stats, &st, i - begin);
+    }
+#endif
+
+    for (; i < end; i++) {
+        double v = linconv1(val[i], c);
+        if (smooth) {
+            v = smooth1(v, state[i], c);
+        }
+        val[i] = v;
+        if (state) {
+            state[i] = v;
+        }
+        if (stats) {
+            devTextFileStatsAdd(stats, val[i]);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// LONG: int32 to double conversion, rounded and saturated on store
+//
+static void convertLong(int32_t *val, double *state, uint32_t begin, uint32_t end, const conv_t *c, bool smooth, TextFileStats_t *stats)
+{
+    uint32_t i = begin;
+
+#if defined(__SSE2__)
+    const __m128d a  = _mm_set1_pd(c->aslo);
+    const __m128d b  = _mm_set1_pd(c->aoff);
+    const __m128d s  = _mm_set1_pd(c->smoo);
+    const __m128d s1 = _mm_set1_pd(1.00 - c->smoo);
+    stats2_t st;
+    stats2Init(&st);
+    const __m128d lo = _mm_set1_pd(INT32_MIN);
+    const __m128d hi = _mm_set1_pd(INT32_MAX);
+
+    for (; i + 2 <= end; i += 2) {
+        __m128d x = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *)(val + i)));
+        __m128d v = linconv2(x, a, b);
+        if (smooth) {
+            v = smooth2(v, _mm_loadu_pd(state + i), s, s1);
+        }
+        if (state) {
+            _mm_storeu_pd(state + i, v);
+        }
+        v = _mm_min_pd(_mm_max_pd(v, lo), hi); // max_pd returns lo for NaN
+        const __m128i iv = _mm_cvtpd_epi32(v);
+        _mm_storel_epi64((__m128i *)(val + i), iv);
+        if (stats) {
+            stats2Add(&st, _mm_cvtepi32_pd(iv));
+        }
+    }
+    if (stats) {
+        stats2Reduce(stats, &st, i - begin);
+    }
+#endif
+
+    for (; i < end; i++) {
+        double v = linconv1(val[i], c);
+        if (smooth) {
+            v = smooth1(v, state[i], c);
+        }
+        if (state) {
+            state[i] = v;
+        }
+        val[i] = lrint(clamp1(v, INT32_MIN, INT32_MAX));
+        if (stats) {
+            devTextFileStatsAdd(stats, val[i]);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Other integer types, left to the compiler for vectorization
+//
+#define CONVERT_INT(name, type, lo, hi)                                 \
+    static void name(type *val, double *state, uint32_t begin, uint32_t end, const conv_t *c, bool smooth, TextFileStats_t *stats) \
+    {                                                                   \
+        for (uint32_t i = begin; i < end; i++) {                        \
+            double v = linconv1(val[i], c);                             \
+            if (smooth) {                                               \
+                v = smooth1(v, state[i], c);                            \
+            }                                                           \
+            if (state) {                                                \
+                state[i] = v;                                           \
+            }                                                           \
+            val[i] = lrint(clamp1(v, lo, hi));                          \
+            if (stats) {                                                \
+                devTextFileStatsAdd(stats, val[i]);                     \
+            }                                                           \
+        }                                                               \
+    }
+
+CONVERT_INT(convertChar,   int8_t,   INT8_MIN,  INT8_MAX)
+CONVERT_INT(convertUChar,  uint8_t,  0,         UINT8_MAX)
+CONVERT_INT(convertShort,  int16_t,  INT16_MIN, INT16_MAX)
+CONVERT_INT(convertUShort, uint16_t, 0,         UINT16_MAX)
+CONVERT_INT(convertULong,  uint32_t, 0,         UINT32_MAX)
+
+// smoothed values of waveform, attached to TextFile_t
+struct TextFileSmooth {
+    uint32_t        n;          // number of valid elements in values
+    double          values[];   // of the previous read, NELM elements
+};
+
+/////////////////////////////////////////////////////////////////
+//
+// Allocate storage for smoothing of waveform, called from init_record
+//
+void devTextFileSmoothInit(TextFile_t *dpvt, uint32_t nelm)
+{
+    dpvt->smooth = devTextFileCalloc(1, sizeof(TextFileSmooth_t) + nelm * sizeof(double), "calloc for smoothing buffer failed");
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Apply ASLO/AOFF and SMOO given by info tags to n elements in bptr.
+// Smoothed values are kept in dpvt->smooth for the next read. Statistics
+// of the values as stored are taken in the same pass if stats is not NULL.
+//
+void devTextFileConvert(TextFile_t *dpvt, void *bptr, int ftvl, uint32_t n, TextFileStats_t *stats)
+{
+    const conv_t c = { dpvt->aslo, dpvt->aoff, dpvt->smoo };
+    double *state = dpvt->smooth ? dpvt->smooth->values : NULL;
+
+    // elements [0, nsmoo) are smoothed with the previous values, others are just stored
+    uint32_t nsmoo = 0;
+    if (state && c.smoo != 0.0) {
+        nsmoo = (dpvt->smooth->n < n) ? dpvt->smooth->n : n;
+    }
+
+#define CONVERT(func, type)                                             \
+    do {                                                                \
+        func((type *)bptr, state, 0, nsmoo, &c, true, stats);           \
+        func((type *)bptr, state, nsmoo, n, &c, false, stats);          \
+    } while (0)
+
+    if (stats) {
+        devTextFileStatsReset(stats);
+    }
+
+    switch (ftvl) {
+    case DBF_CHAR:   CONVERT(convertChar,   int8_t);   break;
+    case DBF_UCHAR:  CONVERT(convertUChar,  uint8_t);  break;
+    case DBF_SHORT:  CONVERT(convertShort,  int16_t);  break;
+    case DBF_USHORT: CONVERT(convertUShort, uint16_t); break;
+    case DBF_LONG:   CONVERT(convertLong,   int32_t);  break;
+    case DBF_ULONG:  CONVERT(convertULong,  uint32_t); break;
+    case DBF_FLOAT:  CONVERT(convertFloat,  float);    break;
+    case DBF_DOUBLE: CONVERT(convertDouble, double);   break;
+    default:
+        return;
+    }
+
+#undef CONVERT
+
+    //
+    if (state) {
+        dpvt->smooth->n = n;
+    }
+}
+
+// end
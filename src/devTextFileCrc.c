@@ -0,0 +1,345 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "errlog.h"
+#include "epicsThread.h"
+
+//
+#include "devTextFile.h"
+
+// CRC-32C (Castagnoli) in reflected form, as used by iSCSI, ext4 and SSE4.2
+#define CRC32C_POLY 0x82f63b78
+
+// last line of the file, e.g. "#crc32c=e3069283 count=1024"
+#define TRAILER_FORMAT "#crc32c=%8x count=%u"
+
+// state of integrity check, attached to TextFile_t
+struct TextFileCrc {
+    char           *buf;        // whole contents of the file
+    size_t          bufsiz;
+    void           *work;       // values being parsed
+    void           *last;       // values of the last read which matched the trailer
+    long            nlast;      // number of values in last, -1 if none yet
+    TextFileStats_t stats;      // statistics of last
+    int             ftvl;
+    int             nelm;
+    bool            failing;    // error is logged once until a read matches again
+    uint32_t        nchecked;   // number of reads checked
+    uint32_t        nmismatch;  // number of reads not matching the trailer
+};
+
+//
+static uint32_t crcTable[8][256];
+static uint32_t (*crcUpdate)(uint32_t crc, const unsigned char *p, size_t len);
+static const char *crcImpl = "table";
+static epicsThreadOnceId crcOnce = EPICS_THREAD_ONCE_INIT;
+
+// eight bytes at a time by tables, used when CRC instructions are not available
+static uint32_t crcSoftware(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = crcTable[7][lo & 0xff] ^ crcTable[6][(lo >> 8) & 0xff] ^ crcTable[5][(lo >> 16) & 0xff] ^ crcTable[4][lo >> 24] ^
+              crcTable[3][hi & 0xff] ^ crcTable[2][(hi >> 8) & 0xff] ^ crcTable[1][(hi >> 16) & 0xff] ^ crcTable[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = crcTable[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// SSE4.2, selected at run time
+__attribute__((target("sse4.2")))
+static uint32_t crcSse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t val;
+        memcpy(&val, p, 8);
+        crc64 = _mm_crc32_u64(crc64, val);
+        p += 8;
+        len -= 8;
+    }
+    crc = crc64;
+#endif
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+
+    return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+// ARMv8 CRC extension, available when the compiler targets it
+static uint32_t crcArmv8(uint32_t crc, const unsigned char *p, size_t len)
+{
+    while (len >= 8) {
+        uint64_t val;
+        memcpy(&val, p, 8);
+        crc = __crc32cd(crc, val);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32cb(crc, *p++);
+    }
+
+    return crc;
+}
+#endif
+
+//
+static void crcInit(void *arg)
+{
+    for (int i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+        }
+        crcTable[0][i] = crc;
+    }
+    for (int i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            crcTable[t][i] = crcTable[0][crcTable[t-1][i] & 0xff] ^ (crcTable[t-1][i] >> 8);
+        }
+    }
+
+    crcUpdate = crcSoftware;
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse4.2")) {
+        crcUpdate = crcSse42;
+        crcImpl = "SSE4.2";
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    crcUpdate = crcArmv8;
+    crcImpl = "ARMv8";
+#endif
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// CRC-32C of len bytes
+//
+uint32_t devTextFileCrc32c(const void *buf, size_t len)
+{
+    epicsThreadOnce(&crcOnce, crcInit, NULL);
+
+    return ~crcUpdate(~0U, buf, len);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Parse info tag TextFile:CRC, called from devTextFileConfig()
+//
+long devTextFileCrcInit(dbCommon *prec, TextFile_t *dpvt)
+{
+    if (dpvt->sysfs || dpvt->parallel || dpvt->decimate != kDecimNone) {
+        errlogPrintf("%s (%s): TextFile:CRC can't be used with TextFile:SYSFS, TextFile:PARALLEL or TextFile:DECIMATE\n", prec->name, __func__);
+        return -1;
+    }
+
+    dpvt->crc = devTextFileCalloc(1, sizeof(TextFileCrc_t), "calloc for integrity check failed");
+    dpvt->crc->nlast = -1;
+
+    epicsThreadOnce(&crcOnce, crcInit, NULL);
+
+    //
+    return 0;
+}
+
+// read the rest of the file, returns number of bytes or -1 on error
+static ssize_t readRest(TextFileCrc_t *crc, FILE *fp, size_t maxbytes)
+{
+    size_t len = 0;
+
+    while (true) {
+        if (crc->bufsiz - len < 2) {
+            size_t size = crc->bufsiz ? crc->bufsiz * 2 : 4096;
+            char *buf = realloc(crc->buf, size);
+            if (buf == NULL) {
+                errno = ENOMEM;
+                return -1;
+            }
+            crc->buf = buf;
+            crc->bufsiz = size;
+        }
+
+        size_t want = crc->bufsiz - len - 1;
+        if (maxbytes > 0 && want > maxbytes + 1 - len) {
+            want = maxbytes + 1 - len; // one more byte to tell if the limit is exceeded
+        }
+        size_t got = fread(crc->buf + len, 1, want, fp);
+        len += got;
+        if (got < want || (maxbytes > 0 && len > maxbytes)) {
+            break;
+        }
+    }
+    crc->buf[len] = 0;
+
+    return ferror(fp) ? -1 : (ssize_t)len;
+}
+
+// start of the last line which is not empty, or NULL if the file is empty
+static char *lastLine(char *buf, size_t len)
+{
+    while (len > 0 && (buf[len-1] == '\n' || buf[len-1] == '\r' || buf[len-1] == ' ' || buf[len-1] == '\t')) {
+        len --;
+    }
+    if (len == 0) {
+        return NULL;
+    }
+    while (len > 0 && buf[len-1] != '\n') {
+        len --;
+    }
+
+    return buf + len;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read the rest of the file, check it against the trailer and parse it. If it
+// doesn't match, values of the last read which matched are returned again and
+// dpvt->torn is set, so that the record keeps the previous value with READ alarm.
+// Returns number of elements, or -1 if no read has matched yet.
+//
+long devTextFileCrcParse(FILE *fp, const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int *nline, TextFileStats_t *stats, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileCrc_t *crc = dpvt->crc;
+    const size_t size = dbValueSize(ftvl);
+
+    // buffers of values are allocated on the first read, as ftvl and nelm are not known before
+    if (crc->last == NULL) {
+        crc->work = devTextFileCalloc(nelm, size, "calloc for integrity check failed");
+        crc->last = devTextFileCalloc(nelm, size, "calloc for integrity check failed");
+        crc->ftvl = ftvl;
+        crc->nelm = nelm;
+    } else if (ftvl != crc->ftvl || nelm > crc->nelm) {
+        errlogPrintf("%s (%s): FTVL or NELM has been changed\n", prec->name, __func__);
+        return -1;
+    }
+    crc->nchecked ++;
+
+    //
+    const size_t maxbytes = devTextFileByteLimit(dpvt);
+    const char *error = NULL;
+    long n = -1;
+    char *trailer = NULL;
+    uint32_t expected = 0;
+    unsigned int count = 0;
+
+    ssize_t len = readRest(crc, fp, maxbytes);
+    if (len < 0) {
+        error = devTextFileStrerror(errno);
+    } else if (maxbytes > 0 && (size_t)len > maxbytes) {
+        dpvt->capped = true;
+        dpvt->nbytes = maxbytes;
+        error = "file is larger than the limit of bytes";
+    } else if ((trailer = lastLine(crc->buf, len)) == NULL || sscanf(trailer, TRAILER_FORMAT, &expected, &count) != 2) {
+        error = "no trailer";
+    } else if (devTextFileCrc32c(crc->buf, trailer - crc->buf) != expected) {
+        error = "CRC mismatch";
+    } else {
+        // values are parsed aside, so that the last ones are kept on error
+        TextFileStats_t local;
+        if (stats) {
+            local = *stats;
+        }
+
+        FILE *mp = fmemopen(crc->buf, trailer - crc->buf, "r");
+        if (mp == NULL) {
+            error = devTextFileStrerror(errno);
+        } else {
+            n = devTextFileParse(mp, filename, crc->work, prec, ftvl, nelm, nline, stats ? &local : NULL, debug);
+            fclose(mp);
+
+            if (n != (count < (unsigned int)nelm ? count : (unsigned int)nelm)) {
+                error = "count mismatch";
+            } else {
+                void *tmp = crc->last;
+                crc->last = crc->work;
+                crc->work = tmp;
+                crc->nlast = n;
+                if (stats) {
+                    crc->stats = local;
+                }
+            }
+        }
+        dpvt->nbytes = len;
+    }
+
+    //
+    if (error) {
+        crc->nmismatch ++;
+        dpvt->torn = true;
+        if (!crc->failing) {
+            errlogPrintf("%s (%s): \"%s\" doesn't match the trailer: %s, the previous value is kept\n", prec->name, __func__, filename, error);
+        }
+    }
+    crc->failing = (error != NULL);
+
+    if (debug > 0) {
+        printf("%s (%s): %s, %ld value(s) kept\n", prec->name, __func__, error ? error : "matched", crc->nlast);
+    }
+
+    // values of the last read which matched
+    if (crc->nlast > 0) {
+        memcpy(bptr, crc->last, crc->nlast * size);
+    }
+    if (stats && crc->nlast >= 0) {
+        *stats = crc->stats;
+    }
+
+    //
+    return crc->nlast;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report integrity check of the record, called from devTextFileReport()
+//
+void devTextFileCrcReport(const TextFile_t *dpvt)
+{
+    const TextFileCrc_t *crc = dpvt->crc;
+
+    printf("        CRC-32C by %s: %u read(s) checked, %u not matching the trailer\n", crcImpl, crc->nchecked, crc->nmismatch);
+}
+
+// end
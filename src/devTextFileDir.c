@@ -0,0 +1,323 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "errlog.h"
+#include "epicsAtomic.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "epicsTime.h"
+#include "epicsExport.h"
+
+//
+#include "devTextFile.h"
+
+// open files by openat() relative to cached directory, 0 to resolve full path every time
+static int devTextFileDirCache = 1;
+
+// interval in seconds to check if the directory has been replaced
+static double devTextFileDirCheck = 1.0;
+
+// directory shared by records of the files in it, attached to TextFile_t
+struct TextFileDir {
+    const char     *path;       // interned, as given in INP/OUT
+    epicsMutexId    lock;       // guards next
+    int             fd;         // O_PATH descriptor, replaced by dup3() when the directory is replaced
+    int             valid;      // fd refers to the directory at path
+    dev_t           dev;        // identity of the directory when opened
+    ino_t           ino;
+    epicsTimeStamp  next;       // time of the next check
+    int             nrecords;
+    size_t          nopens;     // files opened by openat()
+    size_t          nfallbacks; // files opened by full path while the directory couldn't be opened
+    size_t          nchecks;    // stat() of the directory
+    size_t          nreplaced;  // directory found replaced
+};
+
+//
+static TextFileDir_t **dirList = NULL; // guarded by listLock
+static int dirCount = 0;
+static epicsMutexId listLock = NULL;
+static epicsThreadOnceId dirOnce = EPICS_THREAD_ONCE_INIT;
+
+//
+static void dirInit(void *arg)
+{
+    listLock = epicsMutexMustCreate();
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Check if the directory is still the one opened, and open it again if it has
+// been replaced (renamed, or symbolic link changed). Checked at most once per
+// devTextFileDirCheck seconds unless force is true. Returns true if the
+// descriptor has been replaced.
+//
+static bool dirCheck(TextFileDir_t *d, bool force)
+{
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+
+    epicsMutexMustLock(d->lock);
+    const bool due = force || epicsTimeDiffInSeconds(&now, &d->next) >= 0;
+    if (due) {
+        d->next = now;
+        epicsTimeAddSeconds(&d->next, devTextFileDirCheck);
+    }
+    epicsMutexUnlock(d->lock);
+
+    if (!due) {
+        return false;
+    }
+
+    //
+    struct stat st;
+    epicsAtomicIncrSizeT(&d->nchecks);
+    if (stat(d->path, &st) != 0) {
+        // files are opened by full path, which fails in the same way
+        epicsAtomicSetIntT(&d->valid, 0);
+        return false;
+    }
+    if (d->fd >= 0 && st.st_dev == d->dev && st.st_ino == d->ino) {
+        epicsAtomicSetIntT(&d->valid, 1);
+        return false;
+    }
+
+    //
+    int fd = open(d->path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        epicsAtomicSetIntT(&d->valid, 0);
+        return false;
+    }
+
+    epicsMutexMustLock(d->lock);
+    if (d->fd < 0) {
+        epicsAtomicSetIntT(&d->fd, fd);
+    } else {
+        // readers using the old descriptor get either directory, never a closed one
+        dup3(fd, d->fd, O_CLOEXEC);
+        close(fd);
+        epicsAtomicIncrSizeT(&d->nreplaced);
+    }
+    d->dev = st.st_dev;
+    d->ino = st.st_ino;
+    epicsAtomicSetIntT(&d->valid, 1);
+    epicsMutexUnlock(d->lock);
+
+    //
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Find or create the directory of the file, called from devTextFileConfig()
+//
+void devTextFileDirInit(TextFile_t *dpvt)
+{
+    // "/data/ch1.txt" is split into "/data" and "ch1.txt", "ch1.txt" into "." and "ch1.txt"
+    const char *slash = strrchr(dpvt->name, '/');
+    const char *path;
+    if (slash == NULL) {
+        path = devTextFileIntern(".");
+        dpvt->base = dpvt->name;
+    } else if (slash == dpvt->name) {
+        path = devTextFileIntern("/");
+        dpvt->base = slash + 1;
+    } else {
+        char *dir = strndup(dpvt->name, slash - dpvt->name);
+        if (dir == NULL) {
+            cantProceed("strndup for directory failed");
+        }
+        path = devTextFileIntern(dir);
+        free(dir);
+        dpvt->base = slash + 1;
+    }
+    if (*dpvt->base == 0) {
+        return; // not a file
+    }
+
+    //
+    epicsThreadOnce(&dirOnce, dirInit, NULL);
+    epicsMutexMustLock(listLock);
+
+    TextFileDir_t *d = NULL;
+    for (int i = 0; i < dirCount; i++) {
+        if (dirList[i]->path == path) { // interned
+            d = dirList[i];
+            break;
+        }
+    }
+
+    if (d == NULL) {
+        TextFileDir_t **list = realloc(dirList, (dirCount + 1) * sizeof(TextFileDir_t *));
+        if (list == NULL) {
+            cantProceed("realloc for directories failed");
+        }
+        dirList = list;
+
+        d = devTextFileCalloc(1, sizeof(TextFileDir_t), "calloc for directory failed");
+        d->path = path;
+        d->lock = epicsMutexMustCreate();
+        d->fd = -1;
+        dirList[dirCount++] = d;
+    }
+    d->nrecords ++;
+
+    epicsMutexUnlock(listLock);
+
+    dpvt->dir = d;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Open the file of the record relative to its directory, so that the path is
+// not resolved again. Falls back to the full path if the directory can't be
+// opened. Returns file descriptor, or -1 with errno set.
+//
+int devTextFileOpen(TextFile_t *dpvt, int flags, mode_t mode)
+{
+    TextFileDir_t *d = dpvt->dir;
+
+    if (d == NULL || !devTextFileDirCache) {
+        return open(dpvt->name, flags | O_CLOEXEC, mode);
+    }
+
+    //
+    dirCheck(d, epicsAtomicGetIntT(&d->fd) < 0);
+    if (!epicsAtomicGetIntT(&d->valid)) {
+        epicsAtomicIncrSizeT(&d->nfallbacks);
+        return open(dpvt->name, flags | O_CLOEXEC, mode);
+    }
+
+    int fd = openat(d->fd, dpvt->base, flags | O_CLOEXEC, mode);
+
+    // directory may have been replaced since the last check
+    if (fd < 0 && (errno == ENOENT || errno == ESTALE) && dirCheck(d, true)) {
+        fd = openat(d->fd, dpvt->base, flags | O_CLOEXEC, mode);
+    }
+    epicsAtomicIncrSizeT(&d->nopens);
+
+    //
+    return fd;
+}
+
+// stdio stream of devTextFileOpen(), mode is "r" or "w"
+FILE *devTextFileFopen(TextFile_t *dpvt, const char *mode)
+{
+    const int flags = (mode[0] == 'w') ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+
+    int fd = devTextFileOpen(dpvt, flags, 0666);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    FILE *fp = fdopen(fd, mode);
+    if (fp == NULL) {
+        const int err = errno;
+        close(fd);
+        errno = err;
+    }
+
+    //
+    return fp;
+}
+
+// descriptor of the directory and name relative to it for openat(), e.g. by io_uring
+int devTextFileDirFd(TextFile_t *dpvt, const char **name)
+{
+    TextFileDir_t *d = dpvt->dir;
+
+    if (d == NULL || !devTextFileDirCache) {
+        *name = dpvt->name;
+        return AT_FDCWD;
+    }
+
+    dirCheck(d, epicsAtomicGetIntT(&d->fd) < 0);
+    if (!epicsAtomicGetIntT(&d->valid)) {
+        epicsAtomicIncrSizeT(&d->nfallbacks);
+        *name = dpvt->name;
+        return AT_FDCWD;
+    }
+    epicsAtomicIncrSizeT(&d->nopens);
+
+    *name = dpvt->base;
+    return d->fd;
+}
+
+// stat() of the file of the record, relative to its directory
+int devTextFileStat(TextFile_t *dpvt, struct stat *st)
+{
+    TextFileDir_t *d = dpvt->dir;
+
+    if (d == NULL || !devTextFileDirCache) {
+        return stat(dpvt->name, st);
+    }
+
+    dirCheck(d, epicsAtomicGetIntT(&d->fd) < 0);
+    if (!epicsAtomicGetIntT(&d->valid)) {
+        epicsAtomicIncrSizeT(&d->nfallbacks);
+        return stat(dpvt->name, st);
+    }
+
+    int ret = fstatat(d->fd, dpvt->base, st, 0);
+    if (ret != 0 && (errno == ENOENT || errno == ESTALE) && dirCheck(d, true)) {
+        ret = fstatat(d->fd, dpvt->base, st, 0);
+    }
+
+    //
+    return ret;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report directories of all records, called from dbior through drvTextFile
+//
+void devTextFileDirReport(void)
+{
+    epicsThreadOnce(&dirOnce, dirInit, NULL);
+
+    epicsMutexMustLock(listLock);
+    printf("    directories: %d, %s\n", dirCount, devTextFileDirCache ? "files opened by openat()" : "cache disabled");
+    for (int i = 0; i < dirCount; i++) {
+        const TextFileDir_t *d = dirList[i];
+        printf("        %s: %d record(s), %s, %zu open(s), %zu by full path, %zu check(s), replaced %zu time(s)\n",
+               d->path, d->nrecords, d->valid ? "open" : "not open", d->nopens, d->nfallbacks, d->nchecks, d->nreplaced);
+    }
+    epicsMutexUnlock(listLock);
+}
+
+// Register symbol(s) used by IOC core
+epicsExportAddress(int, devTextFileDirCache);
+epicsExportAddress(double, devTextFileDirCheck);
+
+// end
@@ -0,0 +1,509 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "dbScan.h"
+#include "alarm.h"
+#include "errlog.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "epicsTime.h"
+#include "epicsExport.h"
+#include "gpHash.h"
+
+//
+#include "devTextFile.h"
+
+// verify that the file has not been modified by others before using the value written by this IOC
+static int devTextFileCacheVerify = 1;
+
+// interval in seconds between attempts to open missing or unreadable file
+static double devTextFileRetryMin = 1.0;
+static double devTextFileRetryMax = 60.0;
+
+//
+static struct gphPvt *entryTable = NULL;
+static epicsMutexId entryLock = NULL;
+static epicsThreadOnceId entryOnce = EPICS_THREAD_ONCE_INIT;
+
+//
+static void entryInit(void *arg)
+{
+    gphInitPvt(&entryTable, 1024);
+    entryLock = epicsMutexMustCreate();
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Canonical path of the file, which may not exist yet
+//
+static char *canonicalPath(const char *path)
+{
+    char *real = realpath(path, NULL);
+    if (real) {
+        return real;
+    }
+
+    // canonicalize directory part if the file doesn't exist
+    char *dir = strdup(path);
+    char *slash = strrchr(dir, '/');
+    const char *base = path;
+    char *result = NULL;
+
+    if (slash) {
+        base = path + (slash - dir) + 1;
+        slash[1] = 0;
+    } else {
+        strcpy(dir, ".");
+    }
+
+    real = realpath(dir, NULL);
+    if (real) {
+        const char *sep = (strcmp(real, "/") == 0) ? "" : "/";
+        if (asprintf(&result, "%s%s%s", real, sep, base) < 0) {
+            result = NULL;
+        }
+        free(real);
+    }
+    free(dir);
+
+    return result ? result : strdup(path);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Find or create the entry associated to the file
+//
+TextFileEntry_t *devTextFileEntryGet(const char *filename)
+{
+    epicsThreadOnce(&entryOnce, entryInit, NULL);
+
+    char *path = canonicalPath(filename);
+
+    epicsMutexMustLock(entryLock);
+
+    TextFileEntry_t *entry;
+    GPHENTRY *hash = gphFind(entryTable, path, NULL);
+    if (hash) {
+        entry = hash->userPvt;
+    } else {
+        entry = devTextFileCalloc(1, sizeof(TextFileEntry_t), "calloc for entry failed");
+        entry->path = devTextFileIntern(path);
+        entry->lock = epicsMutexMustCreate();
+        scanIoInit(&entry->ioscanpvt);
+        scanIoInit(&entry->statscan);
+        scanIoInit(&entry->pollscan);
+
+        hash = gphAdd(entryTable, entry->path, NULL);
+        hash->userPvt = entry;
+    }
+
+    epicsMutexUnlock(entryLock);
+
+    free(path);
+
+    return entry;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Publish the value just written by output record, so that input records
+// of the same file in this IOC can take it without reading the file.
+// Must be called after the value has been written but before fclose().
+//
+void devTextFileCachePublish(TextFile_t *dpvt, FILE *fp, const char *text, double value)
+{
+    struct stat st;
+
+    //
+    if (fflush(fp) != 0 || fstat(fileno(fp), &st) != 0) {
+        devTextFileCacheInvalidate(dpvt);
+        return;
+    }
+
+    devTextFileCacheStore(dpvt, &st, text, value);
+}
+
+// same as above with the file already written and stat()ed
+void devTextFileCacheStore(TextFile_t *dpvt, const struct stat *st, const char *text, double value)
+{
+    TextFileEntry_t *entry = dpvt->entry;
+
+    epicsMutexMustLock(entry->lock);
+    entry->cached = true;
+    strncpy(entry->text, text, sizeof(entry->text));
+    entry->text[sizeof(entry->text)-1] = 0;
+    entry->value = value;
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+    epicsMutexUnlock(entry->lock);
+
+    // the file exists now
+    devTextFileNegativeClear(entry);
+
+    // process input records with SCAN="I/O Intr"
+    scanIoRequest(entry->ioscanpvt);
+}
+
+//
+void devTextFileCacheInvalidate(TextFile_t *dpvt)
+{
+    TextFileEntry_t *entry = dpvt->entry;
+
+    epicsMutexMustLock(entry->lock);
+    entry->cached = false;
+    epicsMutexUnlock(entry->lock);
+
+    // the file may have been created by this write
+    devTextFileNegativeClear(entry);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Negative cache of missing or unreadable file. Attempts to open the file are
+// backed off exponentially while it keeps failing, so that many records don't
+// flood the file server with failing lookups.
+// Returns errno of the latest failure if the file shouldn't be opened now, or 0.
+//
+int devTextFileNegativeCheck(TextFileEntry_t *entry)
+{
+    epicsTimeStamp now;
+    int err = 0;
+
+    epicsMutexMustLock(entry->lock);
+    if (entry->negerr != 0) {
+        epicsTimeGetCurrent(&now);
+        if (epicsTimeDiffInSeconds(&entry->negnext, &now) > 0) {
+            err = entry->negerr;
+            entry->nskipped ++;
+        }
+    }
+    epicsMutexUnlock(entry->lock);
+
+    return err;
+}
+
+// Record a failure to open, returns true if it should be reported
+bool devTextFileNegativeFail(TextFileEntry_t *entry, int err)
+{
+    const double retryMin = (devTextFileRetryMin > 0) ? devTextFileRetryMin : 1.0;
+    const double retryMax = (devTextFileRetryMax > retryMin) ? devTextFileRetryMax : retryMin;
+    bool report;
+
+    // other errors may be transient, and are reported every time
+    if (err != ENOENT && err != ENOTDIR && err != EACCES) {
+        return true;
+    }
+
+    epicsMutexMustLock(entry->lock);
+    report = (entry->negerr != err);
+    if (report) {
+        entry->negint = retryMin;
+    } else {
+        entry->negint *= 2;
+        if (entry->negint > retryMax) {
+            entry->negint = retryMax;
+        }
+    }
+    entry->negerr = err;
+    epicsTimeGetCurrent(&entry->negnext);
+    epicsTimeAddSeconds(&entry->negnext, entry->negint);
+    epicsMutexUnlock(entry->lock);
+
+    return report;
+}
+
+// Forget the failure, called when the file is known to exist
+void devTextFileNegativeClear(TextFileEntry_t *entry)
+{
+    epicsMutexMustLock(entry->lock);
+    entry->negerr = 0;
+    entry->negint = 0;
+    epicsMutexUnlock(entry->lock);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Take single value from write-through cache.
+// Returns 1 on success, or 0 if the file has to be read.
+//
+long devTextFileCacheRead(dbCommon *prec, void *bptr, int ftvl)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileEntry_t *entry = dpvt->entry;
+    struct stat st;
+
+    // nothing has been written by this IOC
+    if (!entry->cached) {
+        return 0;
+    }
+
+    // check if the file has not been modified by others
+    if (devTextFileCacheVerify && devTextFileStat(dpvt, &st) != 0) {
+        return 0;
+    }
+
+    epicsMutexMustLock(entry->lock);
+    bool hit = entry->cached;
+    if (hit && devTextFileCacheVerify) {
+        hit = (st.st_dev == entry->dev &&
+               st.st_ino == entry->ino &&
+               st.st_size == entry->size &&
+               st.st_mtim.tv_sec == entry->mtime.tv_sec &&
+               st.st_mtim.tv_nsec == entry->mtime.tv_nsec);
+    }
+    char text[sizeof(entry->text)];
+    strcpy(text, entry->text);
+    const double value = entry->value;
+    const struct timespec mtime = entry->mtime;
+    epicsMutexUnlock(entry->lock);
+
+    if (!hit) {
+        return 0;
+    }
+
+    // convert in the same way as devTextFileParse()
+    char *endptr = text;
+    long ival = 0;
+    switch (ftvl) {
+    case DBF_STRING:
+        strncpy(bptr, text, MAX_STRING_SIZE);
+        ((char *)bptr)[MAX_STRING_SIZE-1] = 0;
+        break;
+    case DBF_FLOAT:
+        *(float *)bptr = value;
+        break;
+    case DBF_DOUBLE:
+        *(double *)bptr = value;
+        break;
+    default:
+        errno = 0;
+        ival = strtol(text, &endptr, 0);
+        if (errno != 0 || endptr == text) {
+            return 0; // let devTextFileParse() report the error
+        }
+        switch (ftvl) {
+        case DBF_CHAR:   *(int8_t   *)bptr = ival; break;
+        case DBF_UCHAR:  *(uint8_t  *)bptr = ival; break;
+        case DBF_SHORT:  *(int16_t  *)bptr = ival; break;
+        case DBF_USHORT: *(uint16_t *)bptr = ival; break;
+        case DBF_LONG:   *(int32_t  *)bptr = ival; break;
+        case DBF_ULONG:  *(uint32_t *)bptr = ival; break;
+        default:
+            return 0;
+        }
+    }
+
+    // modification time for TSE=-2 and TextFile:FRESHNESS
+    if (dpvt->age || prec->tse == epicsTimeEventDeviceTime) {
+        devTextFileFreshTime(prec, &mtime);
+    }
+
+    //
+    dpvt->ncached ++;
+    prec->udf = FALSE;
+
+    //
+    return 1;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Companion records of statistics are specified by suffix in INP field,
+// e.g. "@/path/to/file?mean". The suffix is removed from dpvt->name, so
+// this must be called before devTextFileConfig().
+//
+long devTextFileStatsInit(dbCommon *prec, TextFile_t *dpvt)
+{
+    static const struct {
+        const char *suffix;
+        stat_t      stat;
+    } stats[] = {
+        { "min",   kStatMin   },
+        { "max",   kStatMax   },
+        { "sum",   kStatSum   },
+        { "mean",  kStatMean  },
+        { "rms",   kStatRms   },
+        { "count", kStatCount },
+    };
+
+    const char *p = strrchr(dpvt->name, '?');
+    if (p == NULL) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(stats) / sizeof(stats[0]); i++) {
+        if (strcmp(p + 1, stats[i].suffix) == 0) {
+            // interned name is shared, so the file name is interned separately
+            char *name = strndup(dpvt->name, p - dpvt->name);
+            if (name == NULL) {
+                cantProceed("strndup for filename failed");
+            }
+            dpvt->name = devTextFileIntern(name);
+            free(name);
+            dpvt->stat = stats[i].stat;
+            return 0;
+        }
+    }
+
+    errlogPrintf("%s (%s): unknown statistics \"%s\"\n", prec->name, __func__, p + 1);
+    return -1;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Start statistics of a read, accumulated by devTextFileStatsAdd()
+//
+void devTextFileStatsReset(TextFileStats_t *stats)
+{
+    stats->min   = INFINITY;
+    stats->max   = -INFINITY;
+    stats->sum   = 0;
+    stats->sumsq = 0;
+    stats->count = 0;
+}
+
+// add statistics of a part of the values, e.g. taken by a worker thread
+void devTextFileStatsMerge(TextFileStats_t *stats, const TextFileStats_t *part)
+{
+    if (part->min < stats->min) {
+        stats->min = part->min;
+    }
+    if (part->max > stats->max) {
+        stats->max = part->max;
+    }
+    stats->sum   += part->sum;
+    stats->sumsq += part->sumsq;
+    stats->count += part->count;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Copy n elements of size bytes, e.g. from a ring or shared memory, adding
+// them to stats in the same pass if stats is not NULL
+//
+void devTextFileStatsCopy(void *dst, const void *src, int ftvl, size_t size, uint32_t n, TextFileStats_t *stats)
+{
+    if (stats == NULL) {
+        memcpy(dst, src, n * size);
+        return;
+    }
+
+#define COPY(type)                                                      \
+    do {                                                                \
+        const type *from = src;                                         \
+        type *to = dst;                                                 \
+        for (uint32_t i = 0; i < n; i++) {                              \
+            to[i] = from[i];                                            \
+            devTextFileStatsAdd(stats, to[i]);                          \
+        }                                                               \
+    } while (0)
+
+    switch (ftvl) {
+    case DBF_CHAR:   COPY(int8_t);   break;
+    case DBF_UCHAR:  COPY(uint8_t);  break;
+    case DBF_SHORT:  COPY(int16_t);  break;
+    case DBF_USHORT: COPY(uint16_t); break;
+    case DBF_LONG:   COPY(int32_t);  break;
+    case DBF_ULONG:  COPY(uint32_t); break;
+    case DBF_FLOAT:  COPY(float);    break;
+    case DBF_DOUBLE: COPY(double);   break;
+    default:
+        memcpy(dst, src, n * size);
+        break;
+    }
+
+#undef COPY
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Publish statistics of the latest read to the companion records.
+// With ASLO/AOFF/SMOO, they are taken by devTextFileConvert() over the
+// converted values instead of while parsing.
+//
+void devTextFileStatsPublish(TextFile_t *dpvt)
+{
+    TextFileEntry_t *entry = dpvt->entry;
+    const TextFileStats_t stats = dpvt->stats;
+
+    epicsMutexMustLock(entry->lock);
+    entry->stats = stats;
+    epicsMutexUnlock(entry->lock);
+
+    // not the list of write-through, which includes the waveform itself
+    scanIoRequest(entry->statscan);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read statistics for companion record
+//
+long devTextFileStatsRead(dbCommon *prec, double *val)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileEntry_t *entry = dpvt->entry;
+
+    epicsMutexMustLock(entry->lock);
+    TextFileStats_t stats = entry->stats;
+    epicsMutexUnlock(entry->lock);
+
+    //
+    if (stats.count == 0 && dpvt->stat != kStatCount) {
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+        return -1;
+    }
+
+    switch (dpvt->stat) {
+    case kStatMin:   *val = stats.min; break;
+    case kStatMax:   *val = stats.max; break;
+    case kStatSum:   *val = stats.sum; break;
+    case kStatMean:  *val = stats.sum / stats.count; break;
+    case kStatRms:   *val = sqrt(stats.sumsq / stats.count); break;
+    case kStatCount: *val = stats.count; break;
+    default:
+        return -1;
+    }
+
+    //
+    prec->udf = FALSE;
+
+    //
+    return 1;
+}
+
+// Register symbol(s) used by IOC core
+epicsExportAddress(int, devTextFileCacheVerify);
+epicsExportAddress(double, devTextFileRetryMin);
+epicsExportAddress(double, devTextFileRetryMax);
+
+// end
@@ -0,0 +1,137 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "epicsTime.h"
+
+//
+#include "devTextFile.h"
+
+/////////////////////////////////////////////////////////////////
+//
+// Allocate histogram of age for TextFile:FRESHNESS, called from devTextFileConfig()
+//
+void devTextFileFreshInit(TextFile_t *dpvt)
+{
+    dpvt->age = devTextFileCalloc(1, sizeof(TextFileAge_t), "calloc for age histogram failed");
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Take modification time of the file just opened. The record TIME is set from it
+// if TSE is -2, and the age of the contents is accumulated in the histogram.
+// fd is used if not negative, otherwise the file is looked up in its directory.
+//
+void devTextFileFresh(dbCommon *prec, int fd)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    struct stat st;
+
+    if (dpvt->age == NULL && prec->tse != epicsTimeEventDeviceTime) {
+        return;
+    }
+
+    if ((fd >= 0) ? fstat(fd, &st) != 0 : devTextFileStat(dpvt, &st) != 0) {
+        return;
+    }
+
+    devTextFileFreshTime(prec, &st.st_mtim);
+}
+
+// same as above with the modification time already known, e.g. by write-through cache
+void devTextFileFreshTime(dbCommon *prec, const struct timespec *ts)
+{
+    TextFile_t *dpvt = prec->dpvt;
+
+    //
+    epicsTimeStamp mtime;
+    epicsTimeFromTimespec(&mtime, ts);
+    if (prec->tse == epicsTimeEventDeviceTime) {
+        prec->time = mtime;
+    }
+
+    //
+    TextFileAge_t *age = dpvt->age;
+    if (age == NULL) {
+        return;
+    }
+
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    const double sec = epicsTimeDiffInSeconds(&now, &mtime);
+
+    age->count ++;
+    if (sec < 0) {
+        age->negative ++; // clocks of the writer and the file server differ
+        return;
+    }
+    age->sum += sec;
+    if (sec > age->max) {
+        age->max = sec;
+    }
+
+    // bin i holds ages in [2^(i-1), 2^i) milliseconds, and the last bin holds the rest
+    int bin = 0;
+    for (double ms = sec * 1e3; ms >= 1.0 && bin < AGE_BINS - 1; ms /= 2) {
+        bin ++;
+    }
+    age->bins[bin] ++;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report histogram of age, called from devTextFileReport()
+//
+void devTextFileFreshReport(const TextFile_t *dpvt)
+{
+    const TextFileAge_t *age = dpvt->age;
+    const uint32_t count = age->count - age->negative;
+
+    printf("        age of contents: %u read(s)", age->count);
+    if (count > 0) {
+        printf(", mean %.3f s, max %.3f s", age->sum / count, age->max);
+    }
+    if (age->negative > 0) {
+        printf(", %u in the future", age->negative);
+    }
+    printf("\n");
+
+    for (int i = 0; i < AGE_BINS; i++) {
+        if (age->bins[i] == 0) {
+            continue;
+        }
+        if (i == 0) {
+            printf("            < 1 ms: %u\n", age->bins[i]);
+        } else if (i == AGE_BINS - 1) {
+            printf("            >= %.0f ms: %u\n", (double)(1u << (i - 1)), age->bins[i]);
+        } else {
+            printf("            < %.0f ms: %u\n", (double)(1u << i), age->bins[i]);
+        }
+    }
+}
+
+// end
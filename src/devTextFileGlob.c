@@ -0,0 +1,413 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "alarm.h"
+#include "errlog.h"
+#include "epicsAtomic.h"
+#include "epicsEvent.h"
+#include "epicsString.h"
+#include "epicsThread.h"
+#include "epicsThreadPool.h"
+
+//
+#include "devTextFile.h"
+
+// size of buffer for getdents64()
+#define DIRENT_BUFSIZ 32768
+
+// files read in the calling thread without the thread pool
+#define GLOB_INLINE 8
+
+// layout of struct linux_dirent64, which is not declared by glibc
+struct dirent64_t {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+// slice of files read by a worker thread
+typedef struct {
+    TextFileGlob_t *glob;
+    epicsJob       *job;
+    char           *buf;        // read buffer of devTextFileLineLimit() + 2 bytes
+    uint32_t        begin;
+    uint32_t        end;
+    TextFileStats_t stats;      // of the values read by the slice
+} slice_t;
+
+// files in a directory matching a pattern, read into a waveform
+struct TextFileGlob {
+    char           *dir;
+    char           *pattern;
+    int             dirfd;      // kept open for openat()
+    ino_t           ino;        // identity of the directory at the latest listing
+    struct timespec mtime;
+    bool            listed;
+    char          **names;      // sorted names of matching files
+    uint32_t        nnames;
+    uint32_t        nlists;     // number of listings
+    // for the current read
+    void           *bptr;
+    int             ftvl;
+    bool            dostats;    // for companion records
+    size_t          bufsiz;
+    size_t          maxline;
+    int             nfailed;    // files which couldn't be read or parsed
+    int             overlong;
+    uint32_t        lastfailed; // number of failures reported last time
+    slice_t        *slices;
+    int             nslices;
+    int             pending;
+    epicsEventId    done;
+};
+
+/////////////////////////////////////////////////////////////////
+//
+// Set up reading of files matching the pattern in INP, e.g. "@/data/ch*.txt".
+// Returns 0 if INP doesn't contain a pattern, 1 if it does, or -1 on error.
+//
+long devTextFileGlobInit(dbCommon *prec, TextFile_t *dpvt)
+{
+    const char *slash = strrchr(dpvt->name, '/');
+    const char *base = slash ? slash + 1 : dpvt->name;
+
+    if (strpbrk(base, "*?[") == NULL) {
+        return 0;
+    }
+    if (slash && strpbrk(dpvt->name, "*?[") < slash) {
+        errlogPrintf("%s (%s): pattern is allowed only in the file name: \"%s\"\n", prec->name, __func__, dpvt->name);
+        return -1;
+    }
+    if (dpvt->batch || dpvt->sysfs || dpvt->refresh || dpvt->crc || dpvt->stream || dpvt->shm || dpvt->sidecar || dpvt->advise || dpvt->decimate != kDecimNone) {
+        errlogPrintf("%s (%s): pattern can't be used with TextFile:BATCH, TextFile:GROUP, TextFile:SYSFS, TextFile:REFRESH, TextFile:CRC, TextFile:STREAM, TextFile:SHM, TextFile:SIDECAR, TextFile:ADVISE, TextFile:PREFETCH or TextFile:DECIMATE\n", prec->name, __func__);
+        return -1;
+    }
+
+    //
+    TextFileGlob_t *glob = devTextFileCalloc(1, sizeof(TextFileGlob_t), "calloc for glob failed");
+    if (slash == NULL) {
+        glob->dir = epicsStrDup(".");
+    } else if (slash == dpvt->name) {
+        glob->dir = epicsStrDup("/");
+    } else {
+        glob->dir = devTextFileCalloc(1, slash - dpvt->name + 1, "calloc for directory name failed");
+        memcpy(glob->dir, dpvt->name, slash - dpvt->name);
+    }
+    glob->pattern = epicsStrDup(base);
+    glob->dirfd = -1;
+
+    //
+    glob->nslices = devTextFileThreads();
+    glob->slices = devTextFileCalloc(glob->nslices, sizeof(slice_t), "calloc for glob slices failed");
+    glob->bufsiz = devTextFileLineLimit(dpvt) + 2; // newline and terminating null
+    glob->maxline = devTextFileLineLimit(dpvt);
+
+    for (int i = 0; i < glob->nslices; i++) {
+        slice_t *slice = &glob->slices[i];
+        slice->glob = glob;
+        slice->buf = devTextFileCalloc(1, glob->bufsiz, "calloc for glob buffer failed");
+    }
+    glob->done = epicsEventMustCreate(epicsEventEmpty);
+
+    dpvt->glob = glob;
+
+    //
+    return 1;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// List the directory again if it has been modified since the latest listing.
+// Names are sorted in natural order, so that "ch10" follows "ch9".
+// Returns 1 if listed again, 0 if not modified, or -1 on error.
+//
+static int compareNames(const void *a, const void *b)
+{
+    return strverscmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int listDirectory(TextFileGlob_t *glob)
+{
+    struct stat st;
+
+    // directory may have been replaced
+    if (stat(glob->dir, &st) != 0) {
+        return -1;
+    }
+    if (glob->dirfd >= 0 && st.st_ino != glob->ino) {
+        close(glob->dirfd);
+        glob->dirfd = -1;
+        glob->listed = false;
+    }
+    if (glob->listed &&
+        st.st_mtim.tv_sec == glob->mtime.tv_sec &&
+        st.st_mtim.tv_nsec == glob->mtime.tv_nsec) {
+        return 0;
+    }
+
+    if (glob->dirfd < 0) {
+        glob->dirfd = open(glob->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (glob->dirfd < 0) {
+            return -1;
+        }
+    }
+    if (lseek(glob->dirfd, 0, SEEK_SET) != 0) {
+        return -1;
+    }
+
+    // names are replaced as a whole
+    for (uint32_t i = 0; i < glob->nnames; i++) {
+        free(glob->names[i]);
+    }
+    glob->nnames = 0;
+
+    uint32_t nalloc = 0;
+    char *buf = mallocMustSucceed(DIRENT_BUFSIZ, "malloc for directory entries failed");
+    while (true) {
+        long len = syscall(SYS_getdents64, glob->dirfd, buf, DIRENT_BUFSIZ);
+        if (len < 0) {
+            free(buf);
+            return -1;
+        }
+        if (len == 0) {
+            break;
+        }
+
+        for (long off = 0; off < len; ) {
+            struct dirent64_t *d = (struct dirent64_t *)(buf + off);
+            off += d->d_reclen;
+
+            if (d->d_type == DT_DIR || fnmatch(glob->pattern, d->d_name, FNM_PERIOD) != 0) {
+                continue;
+            }
+            if (glob->nnames == nalloc) {
+                nalloc = nalloc ? nalloc * 2 : 64;
+                glob->names = realloc(glob->names, nalloc * sizeof(char *));
+                if (glob->names == NULL) {
+                    cantProceed("realloc for file names failed");
+                }
+            }
+            glob->names[glob->nnames++] = epicsStrDup(d->d_name);
+        }
+    }
+    free(buf);
+
+    qsort(glob->names, glob->nnames, sizeof(char *), compareNames);
+
+    glob->ino = st.st_ino;
+    glob->mtime = st.st_mtim;
+    glob->listed = true;
+    glob->nlists ++;
+
+    return 1;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read the first value of each file in the slice into its element
+//
+static void readSlice(slice_t *slice)
+{
+    TextFileGlob_t *glob = slice->glob;
+    TextFileStats_t *stats = glob->dostats ? &slice->stats : NULL;
+
+    if (stats) {
+        devTextFileStatsReset(stats);
+    }
+    for (uint32_t i = slice->begin; i < slice->end; i++) {
+        ssize_t len = -1;
+        int fd = openat(glob->dirfd, glob->names[i], O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            do {
+                len = read(fd, slice->buf, glob->bufsiz - 1);
+            } while (len < 0 && errno == EINTR);
+            close(fd);
+        }
+
+        // a line not ending in the buffer may have been truncated
+        char *value = NULL;
+        if (len >= 0) {
+            uint32_t overlong = 0;
+            slice->buf[len] = 0;
+            value = devTextFileFirstValue(slice->buf, glob->maxline, (size_t)len == glob->bufsiz - 1, &overlong);
+            if (overlong > 0) {
+                epicsAtomicIncrIntT(&glob->overlong);
+            }
+        }
+        // files which couldn't be read are not taken into statistics
+        if (value == NULL || !devTextFileStoreValue(value, glob->bptr, glob->ftvl, i, stats)) {
+            if (!devTextFileStoreValue("nan", glob->bptr, glob->ftvl, i, NULL)) {
+                devTextFileStoreValue("0", glob->bptr, glob->ftvl, i, NULL); // integer FTVLs
+            }
+            epicsAtomicIncrIntT(&glob->nfailed);
+        }
+    }
+}
+
+static void sliceJob(void *arg, epicsJobMode mode)
+{
+    slice_t *slice = arg;
+    TextFileGlob_t *glob = slice->glob;
+
+    if (mode == epicsJobModeRun) {
+        readSlice(slice);
+    }
+
+    // glob is owned by the thread waiting for the slices
+    if (epicsAtomicDecrIntT(&glob->pending) == 0) {
+        epicsEventMustTrigger(glob->done);
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read the first value of the files matching the pattern into elements of
+// the waveform, in sorted order of the names. Elements of the files which
+// couldn't be read are set to NaN, or 0 for integer FTVLs.
+// Returns number of elements, or -1 on error with alarm set.
+//
+long devTextFileGlobRead(dbCommon *prec, void *bptr, int ftvl, int nelm, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileGlob_t *glob = dpvt->glob;
+
+    //
+    TRACE_BEGIN(prec, kTraceRead);
+    const int listed = listDirectory(glob);
+    if (listed < 0) {
+        const char *errmsg = devTextFileStrerror(errno);
+        errlogPrintf("%s (%s): can't list \"%s\": %s\n", prec->name, __func__, glob->dir, errmsg);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ACCESS_ALARM;
+        TRACE_END(prec, kTraceRead);
+        return -1;
+    }
+
+    const uint32_t n = (glob->nnames < (uint32_t)nelm) ? glob->nnames : (uint32_t)nelm;
+
+    if (debug > 0) {
+        printf("%s (%s): %u file(s) matching \"%s\" in \"%s\"\n", prec->name, __func__, glob->nnames, glob->pattern, glob->dir);
+    }
+
+    //
+    glob->bptr = bptr;
+    glob->ftvl = ftvl;
+    glob->dostats = (dpvt->dostats && dpvt->entry->nstats > 0);
+    epicsAtomicSetIntT(&glob->nfailed, 0);
+    epicsAtomicSetIntT(&glob->overlong, 0);
+
+    int nslices = glob->nslices;
+    if (n <= GLOB_INLINE) {
+        nslices = 1;
+    } else if ((uint32_t)nslices > n) {
+        nslices = n;
+    }
+
+    for (int i = 0; i < nslices; i++) {
+        glob->slices[i].begin = (uint64_t)n * i / nslices;
+        glob->slices[i].end = (uint64_t)n * (i + 1) / nslices;
+    }
+
+    if (nslices == 1) {
+        readSlice(&glob->slices[0]);
+    } else {
+        epicsAtomicSetIntT(&glob->pending, nslices);
+        for (int i = 0; i < nslices; i++) {
+            if (glob->slices[i].job == NULL) {
+                glob->slices[i].job = epicsJobCreate(devTextFileThreadPool(), sliceJob, &glob->slices[i]);
+            }
+            if (glob->slices[i].job == NULL || epicsJobQueue(glob->slices[i].job) != 0) {
+                sliceJob(&glob->slices[i], epicsJobModeRun); // read in this thread
+            }
+        }
+        epicsEventMustWait(glob->done);
+    }
+
+    // statistics for companion records, taken by the slices while storing values
+    if (glob->dostats) {
+        devTextFileStatsReset(&dpvt->stats);
+        for (int i = 0; i < nslices; i++) {
+            devTextFileStatsMerge(&dpvt->stats, &glob->slices[i].stats);
+        }
+    }
+
+    //
+    prec->udf = FALSE;
+
+    //
+    const uint32_t nfailed = epicsAtomicGetIntT(&glob->nfailed);
+    dpvt->noverlong += epicsAtomicGetIntT(&glob->overlong);
+    if (nfailed > 0) {
+        if (nfailed != glob->lastfailed) {
+            errlogPrintf("%s (%s): %u of %u file(s) couldn't be read in \"%s\"\n", prec->name, __func__, nfailed, n, glob->dir);
+        }
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+    }
+    glob->lastfailed = nfailed;
+
+    if (glob->nnames > (uint32_t)nelm) {
+        if (listed > 0) {
+            errlogPrintf("%s (%s): %u file(s) match \"%s\" in \"%s\", only first %d are read\n", prec->name, __func__, glob->nnames, glob->pattern, glob->dir, nelm);
+        }
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+    }
+
+    if (n == 0) {
+        errlogPrintf("%s (%s): No file matches \"%s\" in \"%s\"\n", prec->name, __func__, glob->pattern, glob->dir);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+    }
+
+    //
+    TRACE_END(prec, kTraceRead);
+    return n;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report the pattern of the record, called from devTextFileReport()
+//
+void devTextFileGlobReport(const TextFile_t *dpvt)
+{
+    const TextFileGlob_t *glob = dpvt->glob;
+
+    printf("        %u file(s) matching \"%s\", directory listed %u time(s)\n", glob->nnames, glob->pattern, glob->nlists);
+}
+
+// end
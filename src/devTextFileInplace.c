@@ -0,0 +1,173 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+//
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "alarm.h"
+#include "errlog.h"
+#include "epicsTime.h"
+
+//
+#include "devTextFile.h"
+
+// width of the value field, enough for "%.17lg" of any double
+#define INPLACE_WIDTH 24
+
+// file of output record kept open, attached to TextFile_t
+struct TextFileInplace {
+    int         fd;         // -1 until the file is written in full
+    off_t       offset;     // of the time field, followed by the value field
+    ino_t       ino;        // identity of the file after the latest write
+    off_t       size;
+    struct timespec mtime;
+    bool        failing;    // error is logged once until a write succeeds
+    uint32_t    nupdates;   // values written in place
+    uint32_t    nrewrites;  // files written in full
+};
+
+/////////////////////////////////////////////////////////////////
+//
+// Parse info tag TextFile:INPLACE, called from devTextFileConfig()
+//
+long devTextFileInplaceInit(dbCommon *prec, TextFile_t *dpvt)
+{
+    if (dpvt->format != kText || dpvt->shm) {
+        errlogPrintf("%s (%s): TextFile:INPLACE can't be used with npy format or TextFile:SHM\n", prec->name, __func__);
+        return -1;
+    }
+
+    dpvt->inplace = devTextFileCalloc(1, sizeof(TextFileInplace_t), "calloc for in-place update failed");
+    dpvt->inplace->fd = -1;
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Write value of output record. The file is written in full once, in the same
+// layout as usual but with the time and value fields of fixed width, and kept
+// open. Afterwards only these fields are overwritten by a single pwrite(), so
+// that readers never see the file truncated. The file is written in full again
+// if it has been removed or replaced by others, or changed in size or
+// modification time since the latest write.
+//
+long devTextFileInplaceWrite(dbCommon *prec, const char *writer, const char *text, double value, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileInplace_t *ip = dpvt->inplace;
+    const char *error = NULL;
+    struct stat st;
+
+    // time and value fields, the value right-aligned as parsers skip leading blanks
+    char datetime[32];
+    epicsTimeToStrftime(datetime, sizeof(datetime), "%Y-%m-%d %T", &prec->time);
+
+    char wday[32];
+    epicsTimeToStrftime(wday, sizeof(wday), "(%a)", &prec->time);
+
+    char tail[96];
+    const int len = snprintf(tail, sizeof(tail), "%s.%06d %-5.5s\n%*s\n",
+                             datetime, prec->time.nsec/1000, wday, INPLACE_WIDTH, text);
+
+    // update in place, unless the file has been unlinked, or truncated and
+    // written by others since the latest write
+    if (ip->fd >= 0) {
+        if (fstat(ip->fd, &st) == 0 && st.st_nlink > 0 && st.st_ino == ip->ino && st.st_size == ip->size &&
+            st.st_mtim.tv_sec == ip->mtime.tv_sec && st.st_mtim.tv_nsec == ip->mtime.tv_nsec &&
+            pwrite(ip->fd, tail, len, ip->offset) == len && fstat(ip->fd, &st) == 0) {
+            ip->nupdates ++;
+        } else {
+            close(ip->fd);
+            ip->fd = -1;
+        }
+    }
+
+    // header and fields in a single write
+    if (ip->fd < 0) {
+        // gethostname() won't work if /etc/hostname is empty
+        struct utsname buf;
+        uname(&buf);
+
+        char whole[512];
+        const int offset = snprintf(whole, sizeof(whole) - sizeof(tail), "# saved by %s on %s\n# %s as of ", writer, buf.nodename, prec->name);
+        memcpy(whole + offset, tail, len);
+
+        int fd = devTextFileOpen(dpvt, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            error = devTextFileStrerror(errno);
+        } else if (write(fd, whole, offset + len) != offset + len || fstat(fd, &st) != 0) {
+            error = devTextFileStrerror(errno);
+            close(fd);
+        } else {
+            ip->fd = fd;
+            ip->offset = offset;
+            ip->nrewrites ++;
+        }
+    }
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): %s, %u in place, %u in full\n", prec->name, __func__, error ? error : text, ip->nupdates, ip->nrewrites);
+    }
+
+    if (error) {
+        devTextFileCacheInvalidate(dpvt);
+        if (!ip->failing) {
+            errlogPrintf("%s (%s): can't write \"%s\": %s\n", prec->name, writer, dpvt->name, error);
+            ip->failing = true;
+        }
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = WRITE_ALARM;
+        return -1;
+    }
+    ip->failing = false;
+    ip->ino = st.st_ino;
+    ip->size = st.st_size;
+    ip->mtime = st.st_mtim;
+
+    // publish to input records of the same file
+    devTextFileCacheStore(dpvt, &st, text, value);
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report in-place update of the record, called from devTextFileReport()
+//
+void devTextFileInplaceReport(const TextFile_t *dpvt)
+{
+    const TextFileInplace_t *ip = dpvt->inplace;
+
+    printf("        in place: %u update(s), %u full write(s), %s\n", ip->nupdates, ip->nrewrites, (ip->fd >= 0) ? "open" : "not open");
+}
+
+// end
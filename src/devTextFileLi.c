@@ -45,8 +45,10 @@ static int devTextFileLiDebug = 0;
 /***************************************************************
  * longin (command/response IO)
  ***************************************************************/
+static long report(int);
 static long init(void);
 static long init_record(struct longinRecord *);
+static long get_ioint_info(int, struct dbCommon *, IOSCANPVT *);
 static long read_li(struct longinRecord *);
 
 struct {
@@ -59,16 +61,22 @@ struct {
     DEVSUPFUN   special_linconv;
 } devTextFileLi = {
     6,
-    NULL,
+    report,
     init,
     init_record,
-    NULL,
+    get_ioint_info,
     read_li,
     NULL
 };
 
 epicsExportAddress(dset, devTextFileLi);
 
+//
+static long report(int level)
+{
+    return devTextFileReport(level, &devTextFileLi);
+}
+
 //
 static long init(void)
 {
@@ -93,7 +101,7 @@ static long init_record(struct longinRecord *prec)
     }
 
     // Allocate private data storage area
-    TextFile_t *dpvt = callocMustSucceed(1, sizeof(TextFile_t), "calloc for private_t failed ");
+    TextFile_t *dpvt = devTextFileAlloc();
     prec->dpvt = dpvt;
 
     // Extract input filename
@@ -105,16 +113,29 @@ static long init_record(struct longinRecord *prec)
         pstr++;
     }
 
-    const size_t fsize = strlen(pstr) + 1;
-    //if (fsize > MAX_INSTIO_STRING) {
-    //    errlogPrintf("%s (devTextFileLi): INP field is too long\n", prec->name);
-    //    return -1;
-    //}
-    dpvt->name = callocMustSucceed(1, fsize, "calloc for filename failed");
-    strcpy(dpvt->name, pstr);
+    // records referring to the same file share the name
+    dpvt->name = devTextFileIntern(pstr);
+
+    // Check if this is a companion record of statistics, e.g. "@/path/to/file?mean"
+    if (devTextFileStatsInit((dbCommon *)prec, dpvt) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
+
+    // Configure options from info tags
+    if (devTextFileConfig((dbCommon *)prec, dpvt) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
+
+    // values pushed through FIFO or socket, see TextFile:STREAM
+    if (dpvt->stream && devTextFileStreamStart((dbCommon *)prec, DBF_LONG, 1) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
 
     //
-    if (dpvt->flag == kRead) {
+    if (dpvt->flag == kRead && dpvt->stat == kStatNone) {
         const char *filename = pstr;
 
         //
@@ -130,6 +151,29 @@ static long init_record(struct longinRecord *prec)
     return 0;
 }
 
+//
+static long get_ioint_info(int cmd, struct dbCommon *prec, IOSCANPVT *ppvt)
+{
+    TextFile_t *dpvt = prec->dpvt;
+
+    //
+    *ppvt = dpvt->ioscanpvt;
+
+    // poll the file while the record is scanned by I/O Intr
+    if (dpvt->poll) {
+        devTextFilePollWatch(dpvt, cmd == 0);
+    }
+    if (dpvt->sysfs) {
+        devTextFileSysfsWatch(dpvt, cmd == 0);
+    }
+    if (dpvt->shm) {
+        devTextFileShmWatch(dpvt, cmd == 0);
+    }
+
+    //
+    return 0;
+}
+
 //
 static long read_li(struct longinRecord *prec)
 {
@@ -143,7 +187,16 @@ static long read_li(struct longinRecord *prec)
     }
 
     //
-    long ret = devTextFileRead(filename, &prec->val, (dbCommon *)prec, DBF_LONG, 1, devTextFileLiDebug);
+    long ret;
+    if (dpvt->stat != kStatNone) {
+        double val = 0;
+        ret = devTextFileStatsRead((dbCommon *)prec, &val);
+        if (ret >= 0) {
+            prec->val = val;
+        }
+    } else {
+        ret = devTextFileRead(filename, &prec->val, (dbCommon *)prec, DBF_LONG, 1, devTextFileLiDebug);
+    }
 
     //
     if (ret < 0) {
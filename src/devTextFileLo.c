@@ -47,6 +47,7 @@ static int devTextFileLoDebug = 0;
 /***************************************************************
  * longout (command/response IO)
  ***************************************************************/
+static long report(int);
 static long init(void);
 static long init_record(struct longoutRecord *);
 static long write_lo(struct longoutRecord *);
@@ -61,7 +62,7 @@ struct {
     DEVSUPFUN   special_linconv;
 } devTextFileLo = {
     6,
-    NULL,
+    report,
     init,
     init_record,
     NULL,
@@ -71,6 +72,12 @@ struct {
 
 epicsExportAddress(dset, devTextFileLo);
 
+//
+static long report(int level)
+{
+    return devTextFileReport(level, &devTextFileLo);
+}
+
 //
 static long init(void)
 {
@@ -95,7 +102,7 @@ static long init_record(struct longoutRecord *prec)
     }
 
     // Allocate private data storage area
-    TextFile_t *dpvt = callocMustSucceed(1, sizeof(TextFile_t), "calloc for private_t failed ");
+    TextFile_t *dpvt = devTextFileAlloc();
     prec->dpvt = dpvt;
 
     // Extract output filename
@@ -107,20 +114,34 @@ static long init_record(struct longoutRecord *prec)
         pstr++;
     }
 
-    const size_t fsize = strlen(pstr) + 1;
-    //if (fsize > MAX_INSTIO_STRING) {
-    //    errlogPrintf("%s (devTextFileLo): INP field is too long\n", prec->name);
-    //    return -1;
-    //}
-    dpvt->name = callocMustSucceed(1, fsize, "calloc for filename failed");
-    strcpy(dpvt->name, pstr);
+    // records referring to the same file share the name
+    dpvt->name = devTextFileIntern(pstr);
+
+    // Configure options from info tags
+    if (devTextFileConfig((dbCommon *)prec, dpvt) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
+
+    // Prepare header for npy format
+    if (dpvt->format == kNpy) {
+        if (devTextFileNpyInit((dbCommon *)prec, DBF_LONG, -1) < 0) {
+            prec->pact = 1;
+            return -1;
+        }
+    }
 
     //
     if (dpvt->flag == kRead) {
         const char *filename = pstr;
 
         //
-        long ret = devTextFileRead(filename, &prec->val, (dbCommon *)prec, DBF_LONG, 1, devTextFileLoDebug);
+        long ret;
+        if (dpvt->format == kNpy) {
+            ret = devTextFileNpyRead(filename, &prec->val, (dbCommon *)prec, DBF_LONG, 1, devTextFileLoDebug);
+        } else {
+            ret = devTextFileRead(filename, &prec->val, (dbCommon *)prec, DBF_LONG, 1, devTextFileLoDebug);
+        }
 
         //
         if (ret < 0) {
@@ -144,11 +165,63 @@ static long write_lo(struct longoutRecord *prec)
         printf("%s (devTextFileLo): filename: %s\n", prec->name, filename);
     }
 
+    // shared memory: published to readers without system calls
+    if (dpvt->shm) {
+        const int32_t val = prec->val;
+        TRACE_BEGIN(prec, kTraceWrite);
+        long ret = devTextFileShmWrite((dbCommon *)prec, &val, DBF_LONG, 1, 1, devTextFileLoDebug);
+        TRACE_END(prec, kTraceWrite);
+
+        //
+        prec->udf = FALSE;
+
+        //
+        return ret;
+    }
+
+    // npy format: header built in init_record followed by raw binary value
+    if (dpvt->format == kNpy) {
+        const int32_t val = prec->val;
+        TRACE_BEGIN(prec, kTraceWrite);
+        long ret = devTextFileNpyWrite(filename, &val, (dbCommon *)prec, DBF_LONG, 1, devTextFileLoDebug);
+        TRACE_END(prec, kTraceWrite);
+        devTextFileCacheInvalidate(dpvt);
+
+        //
+        prec->udf = FALSE;
+
+        //
+        return ret;
+    }
+
+    // fixed-width fields overwritten by a single pwrite(), see TextFile:INPLACE
+    if (dpvt->inplace) {
+        const int32_t val = prec->val;
+        char text[32];
+        snprintf(text, sizeof(text), "%d", val);
+
+        TRACE_BEGIN(prec, kTraceWrite);
+        long ret = devTextFileInplaceWrite((dbCommon *)prec, "devTextFileLo", text, val, devTextFileLoDebug);
+        TRACE_END(prec, kTraceWrite);
+
+        //
+        prec->udf = FALSE;
+
+        //
+        return ret;
+    }
+
     //
-    FILE *fp = fopen(filename, "w");
+    TRACE_BEGIN(prec, kTraceOpen);
+    FILE *fp = devTextFileFopen(dpvt, "w");
+    const int err = errno;
+    TRACE_END(prec, kTraceOpen);
     if (fp == NULL) {
-        char *errmsg = strerror_r(errno, dpvt->errmsg, ERRBUF); // GNU-specific version is assumed
+        devTextFileCacheInvalidate(dpvt);
+        TRACE_BEGIN(prec, kTraceErrlog);
+        const char *errmsg = devTextFileStrerror(err);
         errlogPrintf("%s (devTextFileLo): can't open \"%s\" for writing: %s\n", prec->name, filename, errmsg);
+        TRACE_END(prec, kTraceErrlog);
         prec->nsev = INVALID_ALARM;
         prec->nsta = WRITE_ACCESS_ALARM;
         return -1;
@@ -156,6 +229,7 @@ static long write_lo(struct longoutRecord *prec)
 
     //
     int retval = 0;
+    TRACE_BEGIN(prec, kTraceWrite);
 
     // timestamp
     char datetime[128];
@@ -176,26 +250,38 @@ static long write_lo(struct longoutRecord *prec)
 
     //
     const int32_t val = prec->val;
+    char text[32];
+    snprintf(text, sizeof(text), "%d", val);
+
     const int ret = fprintf(fp,
-                            "# saved by devTextFileLo on %s\n# %s as of %s.%06d %s\n%d\n",
+                            "# saved by devTextFileLo on %s\n# %s as of %s.%06d %s\n%s\n",
                             buf.nodename,
                             prec->name, datetime, prec->time.nsec/1000, wday,
-                            val);
+                            text);
 
     if (ret < 0) {
         // write error
+        TRACE_BEGIN(prec, kTraceErrlog);
         errlogPrintf("%s (devTextFileLo): No data was written to the file: \"%s\"\n", prec->name, filename);
+        TRACE_END(prec, kTraceErrlog);
         prec->nsev = INVALID_ALARM;
         prec->nsta = WRITE_ALARM;
         retval = -1;
+        devTextFileCacheInvalidate(dpvt);
+    } else {
+        // publish to input records of the same file
+        devTextFileCachePublish(dpvt, fp, text, val);
     }
+    TRACE_END(prec, kTraceWrite);
 
     //
     prec->udf = FALSE;
 
     // cleanup
+    TRACE_BEGIN(prec, kTraceClose);
     fclose(fp);
     fp = NULL;
+    TRACE_END(prec, kTraceClose);
 
     //
     return retval;
@@ -0,0 +1,193 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+#include "cantProceed.h"
+#include "dbCommon.h"
+#include "epicsAtomic.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "gpHash.h"
+
+//
+#include "devTextFile.h"
+
+// size of arena chunk, from which private data and file names are taken
+#define ARENA_CHUNK (64 * 1024)
+#define ARENA_ALIGN 16
+
+//
+typedef struct chunk {
+    struct chunk *next;
+    size_t        used;
+    char          data[];
+} chunk_t;
+
+//
+static chunk_t *arena = NULL;       // chunk being filled, guarded by memLock
+static size_t arenaBytes = 0;       // total bytes of chunks
+static uint32_t nrecords = 0;
+static uint32_t nnames = 0;         // distinct file names
+static uint32_t nnameRefs = 0;      // look-ups of file names
+static size_t nameBytes = 0;
+static size_t allocBytes = 0;       // allocated by devTextFileCalloc()
+static struct gphPvt *nameTable = NULL;
+static epicsMutexId memLock = NULL;
+static epicsThreadPrivateId errbufKey = NULL;
+static epicsThreadOnceId memOnce = EPICS_THREAD_ONCE_INIT;
+
+//
+static void memInit(void *arg)
+{
+    memLock = epicsMutexMustCreate();
+    gphInitPvt(&nameTable, 4096);
+    errbufKey = epicsThreadPrivateCreate();
+}
+
+// zero-filled memory which is never freed, called with memLock held
+static void *arenaAlloc(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    // large one doesn't waste the rest of the chunk
+    if (size > ARENA_CHUNK / 4) {
+        arenaBytes += size;
+        return callocMustSucceed(1, size, "calloc for devTextFile arena failed");
+    }
+
+    if (arena == NULL || arena->used + size > ARENA_CHUNK) {
+        chunk_t *chunk = callocMustSucceed(1, sizeof(chunk_t) + ARENA_CHUNK, "calloc for devTextFile arena failed");
+        chunk->next = arena;
+        arena = chunk;
+        arenaBytes += sizeof(chunk_t) + ARENA_CHUNK;
+    }
+
+    void *ptr = arena->data + arena->used;
+    arena->used += size;
+
+    return ptr;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Allocate private data of a record, called from init_record
+//
+TextFile_t *devTextFileAlloc(void)
+{
+    epicsThreadOnce(&memOnce, memInit, NULL);
+
+    epicsMutexMustLock(memLock);
+    TextFile_t *dpvt = arenaAlloc(sizeof(TextFile_t));
+    nrecords ++;
+    epicsMutexUnlock(memLock);
+
+    return dpvt;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Look up file name in the process-wide table, so that records referring to
+// the same file share a single copy. The string returned lives as long as the IOC.
+//
+const char *devTextFileIntern(const char *str)
+{
+    epicsThreadOnce(&memOnce, memInit, NULL);
+
+    epicsMutexMustLock(memLock);
+
+    const char *name;
+    GPHENTRY *hash = gphFind(nameTable, str, NULL);
+    if (hash) {
+        name = hash->name;
+    } else {
+        const size_t size = strlen(str) + 1;
+        char *copy = arenaAlloc(size);
+        memcpy(copy, str, size);
+        nnames ++;
+        nameBytes += size;
+
+        hash = gphAdd(nameTable, copy, NULL);
+        name = copy;
+    }
+    nnameRefs ++;
+
+    epicsMutexUnlock(memLock);
+
+    return name;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Zero-filled memory for buffers of the records, counted in the report
+//
+void *devTextFileCalloc(size_t count, size_t size, const char *errmsg)
+{
+    void *ptr = callocMustSucceed(count, size, errmsg);
+
+    epicsAtomicAddSizeT(&allocBytes, count * size);
+
+    return ptr;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Message of errno in a buffer of the calling thread, valid until the next call
+//
+const char *devTextFileStrerror(int err)
+{
+    epicsThreadOnce(&memOnce, memInit, NULL);
+
+    char *buf = epicsThreadPrivateGet(errbufKey);
+    if (buf == NULL) {
+        buf = mallocMustSucceed(ERRBUF, "malloc for error message failed");
+        epicsThreadPrivateSet(errbufKey, buf);
+    }
+
+    return strerror_r(err, buf, ERRBUF); // GNU-specific version is assumed
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report memory used by the device support, called from dbior through drvTextFile.
+// Buffers growing with the files are summed up by the caller.
+//
+void devTextFileMemReport(size_t buffers)
+{
+    epicsThreadOnce(&memOnce, memInit, NULL);
+
+    epicsMutexMustLock(memLock);
+    const size_t arenaTotal = arenaBytes;
+    const uint32_t records = nrecords;
+    const uint32_t names = nnames;
+    const uint32_t nameRefs = nnameRefs;
+    const size_t nameTotal = nameBytes;
+    epicsMutexUnlock(memLock);
+
+    const size_t allocTotal = epicsAtomicGetSizeT(&allocBytes);
+
+    printf("    memory: %zu bytes in total\n", arenaTotal + allocTotal + buffers);
+    printf("        arena: %zu bytes, %u record(s) of %zu bytes, %u file name(s) of %zu bytes for %u reference(s)\n",
+           arenaTotal, records, sizeof(TextFile_t), names, nameTotal, nameRefs);
+    printf("        buffers: %zu bytes allocated at initialization, %zu bytes for reading\n", allocTotal, buffers);
+}
+
+// end
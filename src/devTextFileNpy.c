@@ -0,0 +1,250 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "alarm.h"
+#include "errlog.h"
+#include "epicsEndian.h"
+
+//
+#include "devTextFile.h"
+
+#if EPICS_BYTE_ORDER == EPICS_ENDIAN_BIG
+#define NPY_ENDIAN ">"
+#else
+#define NPY_ENDIAN "<"
+#endif
+
+// width of the shape field, which is overwritten in place on each write
+#define NPY_SHAPE_WIDTH 10
+
+// .npy header of output record, attached to TextFile_t
+struct TextFileNpy {
+    char            hdr[NPY_HEADER_LEN]; // built during init_record
+    size_t          shape;      // offset of the shape field (0 for scalar)
+};
+
+/////////////////////////////////////////////////////////////////
+//
+// NumPy type descriptor and element size for FTVL
+//
+static const char *npyDescr(int ftvl, size_t *size)
+{
+    switch (ftvl) {
+    case DBF_CHAR:   *size = 1; return "|i1";
+    case DBF_UCHAR:  *size = 1; return "|u1";
+    case DBF_SHORT:  *size = 2; return NPY_ENDIAN "i2";
+    case DBF_USHORT: *size = 2; return NPY_ENDIAN "u2";
+    case DBF_LONG:   *size = 4; return NPY_ENDIAN "i4";
+    case DBF_ULONG:  *size = 4; return NPY_ENDIAN "u4";
+    case DBF_FLOAT:  *size = 4; return NPY_ENDIAN "f4";
+    case DBF_DOUBLE: *size = 8; return NPY_ENDIAN "f8";
+    default:
+        return NULL;
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Build .npy (format version 1.0) header once during init_record.
+// nelm < 0 denotes a scalar, i.e. an array with shape ().
+//
+long devTextFileNpyInit(dbCommon *prec, int ftvl, int nelm)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    size_t size;
+    const char *descr = npyDescr(ftvl, &size);
+
+    if (descr == NULL) {
+        errlogPrintf("%s (%s): unsuppoted FTVL for npy format\n", prec->name, __func__);
+        return -1;
+    }
+
+    //
+    TextFileNpy_t *npy = devTextFileCalloc(1, sizeof(TextFileNpy_t), "calloc for npy header failed");
+    char *hdr = npy->hdr;
+    const char *prefix = "{'descr': '";
+    int len = 10; // magic string, version and header length
+
+    len += sprintf(hdr + len, "%s%s', 'fortran_order': False, 'shape': (", prefix, descr);
+    if (nelm < 0) {
+        npy->shape = 0;
+        len += sprintf(hdr + len, "), }");
+    } else {
+        npy->shape = len;
+        len += sprintf(hdr + len, "%*d,), }", NPY_SHAPE_WIDTH, nelm);
+    }
+
+    // pad with spaces and terminate with newline so that the data is aligned to 64 bytes
+    memset(hdr + len, ' ', NPY_HEADER_LEN - len - 1);
+    hdr[NPY_HEADER_LEN - 1] = '\n';
+
+    memcpy(hdr, "\x93NUMPY\x01\x00", 8);
+    hdr[8] = (NPY_HEADER_LEN - 10) & 0xff;
+    hdr[9] = (NPY_HEADER_LEN - 10) >> 8;
+
+    dpvt->npy = npy;
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Write header and raw array data to .npy file with a single writev()
+//
+long devTextFileNpyWrite(const char *filename, const void *bptr, dbCommon *prec, int ftvl, int nelm, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    size_t size;
+
+    npyDescr(ftvl, &size);
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): filename: %s nelm=%d\n", prec->name, __func__, filename, nelm);
+    }
+
+    // update number of elements in the shape field
+    if (dpvt->npy->shape > 0) {
+        char shape[NPY_SHAPE_WIDTH + 1];
+        snprintf(shape, sizeof(shape), "%*d", NPY_SHAPE_WIDTH, nelm);
+        memcpy(dpvt->npy->hdr + dpvt->npy->shape, shape, NPY_SHAPE_WIDTH);
+    }
+
+    //
+    int fd = devTextFileOpen(dpvt, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        const char *errmsg = devTextFileStrerror(errno);
+        errlogPrintf("%s (%s): can't open \"%s\" for writing: %s\n", prec->name, __func__, filename, errmsg);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = WRITE_ACCESS_ALARM;
+        return -1;
+    }
+
+    //
+    struct iovec iov[2] = {
+        { dpvt->npy->hdr, NPY_HEADER_LEN },
+        { (void *)bptr,   size * nelm },
+    };
+    const ssize_t total = iov[0].iov_len + iov[1].iov_len;
+    const ssize_t ret = writev(fd, iov, 2);
+
+    int retval = 0;
+    if (ret != total) {
+        // write error
+        const char *errmsg = ret < 0 ? devTextFileStrerror(errno) : "short write";
+        errlogPrintf("%s (%s): can't write to the file: \"%s\": %s\n", prec->name, __func__, filename, errmsg);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = WRITE_ALARM;
+        retval = -1;
+    }
+
+    // cleanup
+    close(fd);
+
+    //
+    return retval;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read raw array data from .npy file, e.g. for initial value.
+// Only files whose descriptor matches FTVL are accepted.
+//
+long devTextFileNpyRead(const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    size_t size;
+    const char *descr = npyDescr(ftvl, &size);
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): filename: %s nelm=%d\n", prec->name, __func__, filename, nelm);
+    }
+
+    //
+    FILE *fp = devTextFileFopen(dpvt, "r");
+    if (fp == NULL) {
+        const char *errmsg = devTextFileStrerror(errno);
+        errlogPrintf("%s (%s): can't open \"%s\" for reading: %s\n", prec->name, __func__, filename, errmsg);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ACCESS_ALARM;
+        return -1;
+    }
+
+    // magic string, version and header length
+    unsigned char pre[10];
+    char dict[NPY_HEADER_LEN * 4];
+    size_t hlen = 0;
+    long n = -1;
+
+    if (fread(pre, 1, sizeof(pre), fp) == sizeof(pre) && memcmp(pre, "\x93NUMPY\x01", 7) == 0) {
+        hlen = pre[8] | (pre[9] << 8);
+    }
+
+    if (hlen > 0 && hlen < sizeof(dict) && fread(dict, 1, hlen, fp) == hlen) {
+        dict[hlen] = 0;
+
+        char *pdescr = strstr(dict, "'descr': '");
+        char *pshape = strstr(dict, "'shape': (");
+
+        if (descr && pdescr && pshape && strncmp(pdescr + 10, descr, strlen(descr)) == 0 && strstr(dict, "'fortran_order': False")) {
+            long count = strtol(pshape + 10, NULL, 10);
+            if (pshape[10] == ')') {
+                count = 1; // scalar
+            }
+            if (count > nelm) {
+                count = nelm;
+            }
+            n = fread(bptr, size, count, fp);
+        }
+    }
+
+    if (n <= 0) {
+        errlogPrintf("%s (%s): No data was read from the file: \"%s\"\n", prec->name, __func__, filename);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+        n = 0;
+    }
+
+    //
+    prec->udf = FALSE;
+
+    // cleanup
+    fclose(fp);
+    fp = NULL;
+
+    //
+    return n;
+}
+
+// end
@@ -0,0 +1,423 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "errlog.h"
+#include "epicsAtomic.h"
+#include "epicsEvent.h"
+#include "epicsExport.h"
+#include "epicsThread.h"
+#include "epicsThreadPool.h"
+
+//
+#include "devTextFile.h"
+
+// number of threads parsing a file, 0 for the number of CPUs
+static int devTextFileParallelThreads = 0;
+
+// files smaller than this are parsed by the calling thread
+static int devTextFileParallelMin = 1048576;
+
+// devTextFileParse() stops after nelm values without reading the rest of the file,
+// which is faster than parsing the whole file in parallel for small NELM
+#define PARALLEL_MIN_NELM 65536
+
+// chunk of the file parsed by a worker thread
+typedef struct {
+    TextFileParallel_t *par;
+    epicsJob       *job;
+    const char     *begin;      // starts at beginning of a line
+    const char     *end;        // ends after newline, or at end of the file
+    uint32_t        count;      // lines which are neither empty, comment nor overlong
+    uint32_t        offset;     // index in the record buffer of the first value
+    uint32_t        overlong;   // lines skipped before nelm values have been stored
+    bool            failed;     // a line couldn't be parsed
+    TextFileStats_t stats;      // of the values stored from the chunk
+} chunk_t;
+
+// state of parallel parsing, attached to TextFile_t
+struct TextFileParallel {
+    chunk_t        *chunks;
+    int             nchunks;
+    int             pending;    // number of chunks being processed
+    bool            counting;   // first pass counting lines, or second pass parsing them
+    epicsEventId    done;
+    void           *bptr;
+    int             ftvl;
+    uint32_t        nelm;
+    bool            dostats;    // for companion records
+    size_t          maxline;
+    char           *buf;        // whole contents of the file
+    size_t          bufsiz;
+    size_t          len;
+    uint32_t        nparallel;  // number of reads parsed in parallel
+    uint32_t        nserial;    // number of reads parsed serially after a parse error
+};
+
+//
+static epicsThreadPool *parallelPool = NULL;
+static epicsThreadOnceId parallelOnce = EPICS_THREAD_ONCE_INIT;
+
+//
+static int parallelThreads(void)
+{
+    if (devTextFileParallelThreads > 0) {
+        return devTextFileParallelThreads;
+    }
+    return epicsThreadGetCPUs();
+}
+
+// jobs never wait for each other, so the pool is not shared with the jobs which do
+static void parallelInit(void *arg)
+{
+    epicsThreadPoolConfig config;
+    epicsThreadPoolConfigDefaults(&config);
+    config.maxThreads = parallelThreads();
+    config.initialThreads = config.maxThreads;
+    parallelPool = epicsThreadPoolCreate(&config);
+    if (parallelPool == NULL) {
+        cantProceed("epicsThreadPoolCreate for parallel parsing failed");
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Configure TextFile:PARALLEL, called from devTextFileConfig()
+//
+long devTextFileParallelInit(dbCommon *prec, TextFile_t *dpvt)
+{
+    if (dpvt->batch || dpvt->sysfs || dpvt->decimate != kDecimNone) {
+        errlogPrintf("%s (%s): TextFile:PARALLEL can't be used with TextFile:BATCH, TextFile:GROUP, TextFile:SYSFS or TextFile:DECIMATE\n", prec->name, __func__);
+        return -1;
+    }
+
+    dpvt->parallel = devTextFileCalloc(1, sizeof(TextFileParallel_t), "calloc for parallel parsing failed");
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Classify a line in the same way as devTextFileParse(). Returns pointer to the
+// value, or NULL for empty and comment lines. *overlong is set for lines
+// which don't fit into the line buffer of devTextFileParse().
+//
+static const char *lineValue(const char *line, const char *eol, const char *end, size_t maxline, bool *overlong)
+{
+    const size_t len = eol - line + (eol < end); // including newline
+
+    *overlong = (len > maxline + 1);
+    if (*overlong) {
+        return NULL;
+    }
+
+    const char *pbuf = line;
+    while (pbuf < eol && isspace(*pbuf)) {
+        pbuf ++;
+    }
+    if (pbuf == eol || *pbuf == 0 || *pbuf == '#' || *pbuf == ';' || *pbuf == '!') {
+        return NULL;
+    }
+
+    return pbuf;
+}
+
+//
+static const char *endOfLine(const char *line, const char *end)
+{
+    const char *eol = memchr(line, '\n', end - line);
+    return eol ? eol : end;
+}
+
+// first pass: count lines holding values
+static void countChunk(chunk_t *chunk, size_t maxline)
+{
+    const char *end = chunk->par->buf + chunk->par->len;
+    uint32_t count = 0;
+    bool overlong;
+
+    for (const char *line = chunk->begin; line < chunk->end; ) {
+        const char *eol = endOfLine(line, end);
+        if (lineValue(line, eol, end, maxline, &overlong)) {
+            count ++;
+        }
+        line = eol + 1;
+    }
+
+    chunk->count = count;
+}
+
+// second pass: store values to the record buffer from offset, stopping at nelm
+// values like devTextFileParse(), so that overlong lines are counted in the same way
+static void parseChunk(chunk_t *chunk, void *bptr, int ftvl, uint32_t nelm, size_t maxline)
+{
+    const char *end = chunk->par->buf + chunk->par->len;
+    TextFileStats_t *stats = chunk->par->dostats ? &chunk->stats : NULL;
+    uint32_t index = chunk->offset;
+    bool overlong;
+
+    chunk->overlong = 0;
+    chunk->failed = false;
+    if (stats) {
+        devTextFileStatsReset(stats);
+    }
+    for (const char *line = chunk->begin; line < chunk->end && index < nelm; ) {
+        const char *eol = endOfLine(line, end);
+        const char *pbuf = lineValue(line, eol, end, maxline, &overlong);
+        if (overlong) {
+            chunk->overlong ++;
+        } else if (pbuf) {
+            // the value ends at newline, as the file is null-terminated
+            if (!devTextFileStoreValue(pbuf, bptr, ftvl, index, stats)) {
+                chunk->failed = true;
+                return;
+            }
+            index ++;
+        }
+        line = eol + 1;
+    }
+}
+
+//
+static void chunkJob(void *arg, epicsJobMode mode)
+{
+    chunk_t *chunk = arg;
+    TextFileParallel_t *par = chunk->par;
+
+    if (mode == epicsJobModeRun) {
+        if (par->counting) {
+            countChunk(chunk, par->maxline);
+        } else {
+            parseChunk(chunk, par->bptr, par->ftvl, par->nelm, par->maxline);
+        }
+    }
+
+    // par is owned by the thread waiting for the chunks
+    if (epicsAtomicDecrIntT(&par->pending) == 0) {
+        epicsEventMustTrigger(par->done);
+    }
+}
+
+// run the jobs of the first nchunks chunks and wait for them
+static void runChunks(TextFileParallel_t *par, int nchunks)
+{
+    epicsAtomicSetIntT(&par->pending, nchunks);
+    for (int i = 0; i < nchunks; i++) {
+        if (epicsJobQueue(par->chunks[i].job) != 0) {
+            chunkJob(&par->chunks[i], epicsJobModeRun); // parse in this thread
+        }
+    }
+    epicsEventMustWait(par->done);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read whole file into par->buf, which is null-terminated.
+// Returns number of bytes read, or -1 with errno set.
+//
+static ssize_t readWhole(TextFileParallel_t *par, int fd, size_t size)
+{
+    size_t len = 0;
+
+    while (true) {
+        if (len + 1 >= par->bufsiz) {
+            size_t bufsiz = (size + 2 > par->bufsiz * 2) ? size + 2 : par->bufsiz * 2;
+            char *buf = realloc(par->buf, bufsiz);
+            if (buf == NULL) {
+                cantProceed("realloc for parallel parsing failed");
+            }
+            par->buf = buf;
+            par->bufsiz = bufsiz;
+        }
+
+        ssize_t ret = read(fd, par->buf + len, par->bufsiz - len - 1);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (ret == 0) {
+            break;
+        }
+        len += ret;
+    }
+
+    par->buf[len] = 0;
+
+    return len;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Parse the opened file into the record buffer on a pool of threads, with the
+// same result as devTextFileParse(). The file is split into chunks at newlines,
+// lines holding values are counted per chunk to compute offsets in the record
+// buffer, and then the chunks are parsed into the record buffer in parallel.
+// If any line can't be parsed, the contents are parsed again serially, so that
+// the errors are logged and the following values are shifted in the same way.
+// Returns number of elements read, or -1 if the file is left for devTextFileParse().
+//
+long devTextFileParallelParse(FILE *fp, const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int *nline, TextFileStats_t *stats, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileParallel_t *par = dpvt->parallel;
+
+    // limit of bytes is checked only by devTextFileParse()
+    struct stat st;
+    if (nelm < PARALLEL_MIN_NELM || devTextFileByteLimit(dpvt) > 0 ||
+        fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < devTextFileParallelMin) {
+        return -1;
+    }
+
+    //
+    epicsThreadOnce(&parallelOnce, parallelInit, NULL);
+
+    if (par->chunks == NULL) {
+        par->nchunks = parallelThreads();
+        par->chunks = devTextFileCalloc(par->nchunks, sizeof(chunk_t), "calloc for parallel chunks failed");
+        for (int i = 0; i < par->nchunks; i++) {
+            par->chunks[i].par = par;
+            par->chunks[i].job = epicsJobCreate(parallelPool, chunkJob, &par->chunks[i]);
+            if (par->chunks[i].job == NULL) {
+                cantProceed("epicsJobCreate for parallel parsing failed");
+            }
+        }
+        par->done = epicsEventMustCreate(epicsEventEmpty);
+    }
+
+    //
+    ssize_t len = readWhole(par, fileno(fp), st.st_size);
+    if (len < 0) {
+        errlogPrintf("%s (%s): can't read \"%s\": %s\n", prec->name, __func__, filename, devTextFileStrerror(errno));
+        return 0;
+    }
+    dpvt->nbytes = len;
+    par->len = len;
+
+    // split at newlines
+    const char *end = par->buf + len;
+    const char *begin = par->buf;
+    for (int i = 0; i < par->nchunks; i++) {
+        const char *split = par->buf + (size_t)len * (i + 1) / par->nchunks;
+        if (split < begin) {
+            split = begin;
+        }
+        if (split < end) {
+            const char *eol = memchr(split, '\n', end - split);
+            split = eol ? eol + 1 : end;
+        }
+        par->chunks[i].begin = begin;
+        par->chunks[i].end = split;
+        begin = split;
+    }
+
+    par->bptr = bptr;
+    par->ftvl = ftvl;
+    par->nelm = nelm;
+    par->dostats = (stats != NULL);
+    par->maxline = devTextFileLineLimit(dpvt);
+
+    //
+    par->counting = true;
+    runChunks(par, par->nchunks);
+
+    // offsets of the values of each chunk, up to nelm
+    uint32_t n = 0;
+    int last = 0;
+    for (int i = 0; i < par->nchunks; i++) {
+        chunk_t *chunk = &par->chunks[i];
+        if (n >= (uint32_t)nelm) {
+            break;
+        }
+        chunk->offset = n;
+        n += (chunk->count < nelm - n) ? chunk->count : nelm - n;
+        last = i + 1;
+    }
+
+    // chunks after nelm values have been found are not parsed
+    par->counting = false;
+    runChunks(par, last);
+
+    //
+    bool failed = false;
+    for (int i = 0; i < last; i++) {
+        dpvt->overlong += par->chunks[i].overlong;
+        failed |= par->chunks[i].failed;
+    }
+
+    if (failed) {
+        FILE *mp = fmemopen(par->buf, len, "r");
+        if (mp == NULL) {
+            errlogPrintf("%s (%s): fmemopen failed: %s\n", prec->name, __func__, devTextFileStrerror(errno));
+            return 0;
+        }
+        dpvt->nbytes = 0;
+        dpvt->overlong = 0;
+        n = devTextFileParse(mp, filename, bptr, prec, ftvl, nelm, nline, stats, debug);
+        fclose(mp);
+        par->nserial ++;
+        return n;
+    }
+    par->nparallel ++;
+
+    // statistics taken by the chunks while storing values
+    if (stats) {
+        for (int i = 0; i < last; i++) {
+            devTextFileStatsMerge(stats, &par->chunks[i].stats);
+        }
+    }
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): %zd bytes in %d chunk(s), %u value(s)\n", prec->name, __func__, len, last, n);
+    }
+
+    //
+    return n;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report parallel parsing of the record, called from devTextFileReport()
+//
+void devTextFileParallelReport(const TextFile_t *dpvt)
+{
+    const TextFileParallel_t *par = dpvt->parallel;
+
+    printf("        parsed in parallel: %u read(s), serially after parse error: %u read(s), buffer of %zu bytes\n", par->nparallel, par->nserial, par->bufsiz);
+}
+
+// Register symbol(s) used by IOC core
+epicsExportAddress(int, devTextFileParallelThreads);
+epicsExportAddress(int, devTextFileParallelMin);
+
+// end
@@ -0,0 +1,258 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "dbScan.h"
+#include "errlog.h"
+#include "epicsEvent.h"
+#include "epicsExport.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "epicsTime.h"
+
+//
+#include "devTextFile.h"
+
+// polling interval in seconds, shortest just after a change and longest while unchanged
+static double devTextFilePollMin = 0.5;
+static double devTextFilePollMax = 30.0;
+
+//
+static TextFileEntry_t **pollEntries = NULL; // entries watched at least once, guarded by pollLock
+static int pollCount = 0;
+static epicsMutexId pollLock = NULL;
+static epicsEventId pollWakeup = NULL;
+static epicsThreadOnceId pollOnce = EPICS_THREAD_ONCE_INIT;
+
+//
+static double pollMin(void)
+{
+    return (devTextFilePollMin > 0) ? devTextFilePollMin : 0.5;
+}
+
+static double pollMax(void)
+{
+    return (devTextFilePollMax > pollMin()) ? devTextFilePollMax : pollMin();
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Compare results of stat(), only the fields updated by writing the file
+//
+static bool changed(const struct stat *a, int aerr, const struct stat *b, int berr)
+{
+    if (aerr != 0 || berr != 0) {
+        return aerr != berr;
+    }
+    return (a->st_dev != b->st_dev ||
+            a->st_ino != b->st_ino ||
+            a->st_size != b->st_size ||
+            a->st_mtim.tv_sec != b->st_mtim.tv_sec ||
+            a->st_mtim.tv_nsec != b->st_mtim.tv_nsec);
+}
+
+// entry due for stat(), and its result
+typedef struct {
+    TextFileEntry_t *entry;
+    struct stat      st;
+    int              err;
+} due_t;
+
+/////////////////////////////////////////////////////////////////
+//
+// Poller thread: stat() the watched files when due, process the records on change,
+// and double the interval of the files left unchanged
+//
+static void pollThread(void *arg)
+{
+    due_t *due = NULL;
+    int ndue = 0;
+    int maxdue = 0;
+
+    while (true) {
+        epicsTimeStamp now;
+        double wait = pollMax();
+
+        // entries are never removed, so they can be used after the lock is released
+        epicsMutexMustLock(pollLock);
+        if (maxdue < pollCount) {
+            due_t *list = realloc(due, pollCount * sizeof(due_t));
+            if (list == NULL) {
+                cantProceed("realloc for polled entries failed");
+            }
+            due = list;
+            maxdue = pollCount;
+        }
+        ndue = 0;
+        epicsTimeGetCurrent(&now);
+        for (int i = 0; i < pollCount; i++) {
+            TextFileEntry_t *entry = pollEntries[i];
+
+            double left = epicsTimeDiffInSeconds(&entry->pollnext, &now);
+            if (entry->npoll <= 0) {
+                continue;
+            }
+            if (left > 0) {
+                wait = (left < wait) ? left : wait;
+                continue;
+            }
+            due[ndue++].entry = entry;
+        }
+        epicsMutexUnlock(pollLock);
+
+        // stat() on a network file system may take a while, so it is done without
+        // pollLock, which get_ioint_info takes while holding the record lock
+        for (int i = 0; i < ndue; i++) {
+            due[i].err = (stat(due[i].entry->path, &due[i].st) == 0) ? 0 : errno;
+        }
+
+        //
+        epicsMutexMustLock(pollLock);
+        for (int i = 0; i < ndue; i++) {
+            TextFileEntry_t *entry = due[i].entry;
+            entry->npolls ++;
+
+            if (changed(&due[i].st, due[i].err, &entry->pollst, entry->pollerr)) {
+                entry->pollst = due[i].st;
+                entry->pollerr = due[i].err;
+                entry->pollint = pollMin();
+                entry->nchanges ++;
+                if (due[i].err == 0) {
+                    devTextFileNegativeClear(entry); // the file has appeared
+                }
+                scanIoRequest(entry->pollscan);
+            } else {
+                entry->pollint *= 2;
+                if (entry->pollint > pollMax()) {
+                    entry->pollint = pollMax();
+                }
+            }
+
+            epicsTimeGetCurrent(&entry->pollnext);
+            epicsTimeAddSeconds(&entry->pollnext, entry->pollint);
+            wait = (entry->pollint < wait) ? entry->pollint : wait;
+        }
+        epicsMutexUnlock(pollLock);
+
+        // woken up when a file is newly watched
+        epicsEventWaitWithTimeout(pollWakeup, wait);
+    }
+}
+
+//
+static void pollInit(void *arg)
+{
+    pollLock = epicsMutexMustCreate();
+    pollWakeup = epicsEventMustCreate(epicsEventEmpty);
+
+    epicsThreadMustCreate("devTextFilePoll", epicsThreadPriorityLow,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          pollThread, NULL);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Start or stop watching the file of the record, called from get_ioint_info
+// when the record enters or leaves I/O Intr scan
+//
+void devTextFilePollWatch(TextFile_t *dpvt, bool watch)
+{
+    TextFileEntry_t *entry = dpvt->entry;
+
+    epicsThreadOnce(&pollOnce, pollInit, NULL);
+
+    // reference for the first change, taken before the lock as the poller does
+    struct stat st;
+    const int err = watch ? ((stat(entry->path, &st) == 0) ? 0 : errno) : 0;
+
+    epicsMutexMustLock(pollLock);
+
+    if (!watch) {
+        entry->npoll --;
+        epicsMutexUnlock(pollLock);
+        return;
+    }
+
+    //
+    bool found = false;
+    for (int i = 0; i < pollCount; i++) {
+        if (pollEntries[i] == entry) {
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        TextFileEntry_t **entries = realloc(pollEntries, (pollCount + 1) * sizeof(TextFileEntry_t *));
+        if (entries == NULL) {
+            cantProceed("realloc for polled entries failed");
+        }
+        pollEntries = entries;
+        pollEntries[pollCount++] = entry;
+    }
+
+    // current state of the file is the reference for the first change
+    if (entry->npoll++ == 0) {
+        entry->pollst = st;
+        entry->pollerr = err;
+        entry->pollint = pollMin();
+        epicsTimeGetCurrent(&entry->pollnext);
+        epicsTimeAddSeconds(&entry->pollnext, entry->pollint);
+    }
+
+    epicsMutexUnlock(pollLock);
+
+    epicsEventSignal(pollWakeup);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report polling of the record, called from devTextFileReport()
+//
+void devTextFilePollReport(const TextFile_t *dpvt)
+{
+    const TextFileEntry_t *entry = dpvt->entry;
+
+    if (entry->npoll <= 0) {
+        printf("        not polled\n");
+        return;
+    }
+
+    epicsMutexMustLock(pollLock);
+    const double interval = entry->pollint;
+    const uint32_t npolls = entry->npolls;
+    const uint32_t nchanges = entry->nchanges;
+    epicsMutexUnlock(pollLock);
+
+    printf("        polled every %g second(s): %u stat(s), %u change(s)\n", interval, npolls, nchanges);
+}
+
+// Register symbol(s) used by IOC core
+epicsExportAddress(double, devTextFilePollMin);
+epicsExportAddress(double, devTextFilePollMax);
+
+// end
@@ -17,10 +17,13 @@
 #define _GNU_SOURCE
 #endif
 #include <stdint.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -35,46 +38,165 @@
 #include "errlog.h"
 #include "recGbl.h"
 #include "link.h"
+#include "epicsExport.h"
 
 //
 #include "devTextFile.h"
 
+// default limits of line length and bytes read per read, 0 for unlimited bytes
+static int devTextFileMaxLine = 4096;
+static int devTextFileMaxBytes = 0;
+
+//
+size_t devTextFileLineLimit(const TextFile_t *dpvt)
+{
+    if (dpvt->maxline > 0) {
+        return dpvt->maxline;
+    }
+    return (devTextFileMaxLine > 0) ? devTextFileMaxLine : 4096;
+}
+
+size_t devTextFileByteLimit(const TextFile_t *dpvt)
+{
+    if (dpvt->maxbytes > 0) {
+        return dpvt->maxbytes;
+    }
+    return (devTextFileMaxBytes > 0) ? devTextFileMaxBytes : 0;
+}
+
 /////////////////////////////////////////////////////////////////
 //
-// Read data from file and fill to record buffer
+// Read up to size-1 bytes of a line into buf by fgets(), which scans the
+// stdio buffer for newline a block at a time. Returns number of bytes read,
+// and sets *end unless the line goes on after buf.
 //
-long devTextFileRead(const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int debug)
+static size_t readBlock(FILE *fp, char *buf, size_t size, bool *end)
 {
-    //DBLINK *plink = &prec->inp;
-    TextFile_t *dpvt = prec->dpvt;
-    const char *ftvlstr = (pamapdbfType[ftvl].strvalue) + 4;
+    if (size > INT_MAX) {
+        size = INT_MAX;
+    }
 
-    //
-    if (debug > 0) {
-        printf("%s (%s): filename: %s ftvl=%s nelm=%d\n", prec->name, __func__, filename, ftvlstr, nelm);
+    *end = true;
+    if (fgets(buf, size, fp) == NULL) {
+        buf[0] = 0;
+        return 0;
     }
 
-    //
-    FILE *fp = fopen(filename, "r");
-    if (fp == NULL) {
-        char *errmsg = strerror_r(errno, dpvt->errmsg, ERRBUF); // GNU-specific version is assumed
-        errlogPrintf("%s (%s): can't open \"%s\" for reading: %s\n", prec->name, __func__, filename, errmsg);
-        prec->nsev = INVALID_ALARM;
-        prec->nsta = READ_ACCESS_ALARM;
-        return -1;
+    // the line also ends at end-of-file, and is cut at a null character
+    // which fgets() doesn't tell from the terminating one
+    const size_t len = strlen(buf);
+    if (len == size - 1 && buf[len-1] != '\n' && !feof(fp)) {
+        *end = false;
+    }
+    return len;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read one line including newline into buf. Characters which don't fit into
+// buf are discarded a block at a time without buffering the whole line, and
+// *overlong is set in that case. At most limit bytes are consumed, even if the
+// line doesn't end by then; *eol is set if the line ended by newline or
+// end-of-file. Returns number of bytes consumed from the file, which is 0 at
+// end-of-file.
+//
+static size_t readLine(FILE *fp, char *buf, size_t bufsiz, size_t limit, bool *overlong, bool *eol)
+{
+    bool end;
+
+    *overlong = false;
+    *eol = false;
+    if (limit == 0) {
+        buf[0] = 0;
+        return 0;
     }
 
+    // at most limit bytes, one more for terminating null
+    size_t consumed = readBlock(fp, buf, (limit < bufsiz - 1) ? limit + 1 : bufsiz, &end);
+    if (end) {
+        *eol = true;
+        return consumed;
+    }
 
-    char *buf = NULL;
-    size_t bufsiz = 0;
-    int nline = 0;
+    // rest of a line longer than buf, up to limit
+    char rest[256];
+    while (consumed < limit) {
+        const size_t left = limit - consumed;
+        const size_t n = readBlock(fp, rest, (left < sizeof(rest) - 1) ? left + 1 : sizeof(rest), &end);
+        consumed += n;
+        if (n > 0) {
+            *overlong = true;
+        }
+        if (end) {
+            *eol = true;
+            break;
+        }
+    }
+
+    return consumed;
+}
+
+// check if the limit of bytes per read has been reached before end-of-file
+static bool bytesExceeded(FILE *fp, size_t nbytes, size_t maxbytes)
+{
+    if (maxbytes == 0 || nbytes < maxbytes) {
+        return false;
+    }
+
+    int c = getc_unlocked(fp);
+    if (c == EOF) {
+        return false;
+    }
+    ungetc(c, fp);
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Parse lines from current position of the file and fill up to nelm elements to
+// record buffer. Returns number of elements read, which is 0 at end-of-file.
+//
+long devTextFileParse(FILE *fp, const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int *nline, TextFileStats_t *stats, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+
+    const size_t bufsiz = devTextFileLineLimit(dpvt) + 2; // newline and terminating null
+    const size_t maxbytes = devTextFileByteLimit(dpvt);
+    char *buf = mallocMustSucceed(bufsiz, "malloc for line buffer failed");
     uint32_t n = 0;
-    ssize_t nchars;
+    size_t nchars;
+    bool overlong;
+    bool eol;
+
+    while (true) {
+        // stop reading if the limit of bytes has been reached
+        if (bytesExceeded(fp, dpvt->nbytes, maxbytes)) {
+            dpvt->capped = true;
+            break;
+        }
+
+        nchars = readLine(fp, buf, bufsiz, maxbytes ? maxbytes - dpvt->nbytes : SIZE_MAX, &overlong, &eol);
+        if (nchars == 0) {
+            break;
+        }
+        dpvt->nbytes += nchars;
 
-    while ((nchars = getline(&buf, &bufsiz, fp)) != -1) {
-        nline ++;
+        // don't parse a line truncated by the limit of bytes
+        if (!eol && bytesExceeded(fp, dpvt->nbytes, maxbytes)) {
+            dpvt->capped = true;
+            break;
+        }
+
+        (*nline) ++;
         char *pbuf = buf;
 
+        // skip lines exceeding the maximum length.
+        if (overlong) {
+            dpvt->overlong ++;
+            continue;
+        }
+
         // skip until non white-space character.
         while (isspace(*pbuf)) {
             pbuf ++;
@@ -98,6 +220,8 @@ long devTextFileRead(const char *filename, void *bptr, dbCommon *prec, int ftvl,
         //
         char *endptr = 0;
         errno = 0;
+        double dval = 0;
+        const uint32_t n0 = n;
 
         if (0) {
             //
@@ -114,105 +238,113 @@ long devTextFileRead(const char *filename, void *bptr, dbCommon *prec, int ftvl,
         } else if (ftvl == DBF_CHAR) {
             int val = strtol(pbuf, &endptr, 0);
             if (errno != 0) {
-                char *errmsg = strerror_r(errno, dpvt->errmsg, ERRBUF); // GNU-specific version is assumed
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, nline, errmsg);
+                const char *errmsg = devTextFileStrerror(errno);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, *nline, errmsg);
             } else if (endptr == pbuf) {
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, nline);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, *nline);
             } else {
                 // Read succeeded
                 int8_t *ptr = bptr;
                 ptr[n] = val;
+                dval = ptr[n];
                 n++;
             }
         } else if (ftvl == DBF_UCHAR) {
             int val = strtol(pbuf, &endptr, 0);
             if (errno != 0) {
-                char *errmsg = strerror_r(errno, dpvt->errmsg, ERRBUF); // GNU-specific version is assumed
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, nline, errmsg);
+                const char *errmsg = devTextFileStrerror(errno);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, *nline, errmsg);
             } else if (endptr==pbuf) {
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, nline);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, *nline);
             } else {
                 // Read succeeded
                 uint8_t *ptr = bptr;
                 ptr[n] = val;
+                dval = ptr[n];
                 n++;
             }
         } else if (ftvl == DBF_SHORT) {
             int val = strtol(pbuf, &endptr, 0);
             if (errno != 0) {
-                char *errmsg = strerror_r(errno, dpvt->errmsg, ERRBUF); // GNU-specific version is assumed
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, nline, errmsg);
+                const char *errmsg = devTextFileStrerror(errno);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, *nline, errmsg);
             } else if (endptr==pbuf) {
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, nline);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, *nline);
             } else {
                 // Read succeeded
                 int16_t *ptr = bptr;
                 ptr[n] = val;
+                dval = ptr[n];
                 n++;
             }
         } else if (ftvl == DBF_USHORT) {
             int val = strtol(pbuf, &endptr, 0);
             if (errno != 0) {
-                char *errmsg = strerror_r(errno, dpvt->errmsg, ERRBUF); // GNU-specific version is assumed
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, nline, errmsg);
+                const char *errmsg = devTextFileStrerror(errno);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, *nline, errmsg);
             } else if (endptr==pbuf) {
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, nline);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, *nline);
             } else {
                 // Read succeeded
                 uint16_t *ptr = bptr;
                 ptr[n] = val;
+                dval = ptr[n];
                 n++;
             }
         } else if (ftvl == DBF_LONG) {
             int val = strtol(pbuf, &endptr, 0);
             if (errno != 0) {
-                char *errmsg = strerror_r(errno, dpvt->errmsg, ERRBUF); // GNU-specific version is assumed
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, nline, errmsg);
+                const char *errmsg = devTextFileStrerror(errno);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, *nline, errmsg);
             } else if (endptr==pbuf) {
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, nline);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, *nline);
             } else {
                 // Read succeeded
                 int32_t *ptr = bptr;
                 ptr[n] = val;
+                dval = ptr[n];
                 n++;
             }
         } else if (ftvl == DBF_ULONG) {
             int val = strtol(pbuf, &endptr, 0);
             if (errno != 0) {
-                char *errmsg = strerror_r(errno, dpvt->errmsg, ERRBUF); // GNU-specific version is assumed
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, nline, errmsg);
+                const char *errmsg = devTextFileStrerror(errno);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, *nline, errmsg);
             } else if (endptr==pbuf) {
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, nline);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, *nline);
             } else {
                 // Read succeeded
                 uint32_t *ptr = bptr;
                 ptr[n] = val;
+                dval = ptr[n];
                 n++;
             }
         } else if (ftvl == DBF_FLOAT) {
             double val = strtod(pbuf, &endptr);
             if (errno != 0) {
-                char *errmsg = strerror_r(errno, dpvt->errmsg, ERRBUF); // GNU-specific version is assumed
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, nline, errmsg);
+                const char *errmsg = devTextFileStrerror(errno);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, *nline, errmsg);
             } else if (endptr==pbuf) {
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, nline);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, *nline);
             } else {
                 // Read succeeded
                 float *ptr = bptr;
                 ptr[n] = val;
+                dval = ptr[n];
                 n++;
             }
         } else if (ftvl == DBF_DOUBLE) {
             double val = strtod(pbuf, &endptr);
             if (errno != 0) {
-                char *errmsg = strerror_r(errno, dpvt->errmsg, ERRBUF); // GNU-specific version is assumed
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, nline, errmsg);
+                const char *errmsg = devTextFileStrerror(errno);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: %s\n", prec->name, __func__, filename, *nline, errmsg);
             } else if (endptr==pbuf) {
-                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, nline);
+                errlogPrintf("%s (%s): parse error in \"%s\", line %d: No digits were found\n", prec->name, __func__, filename, *nline);
             } else {
                 // Read succeeded
                 double *ptr = bptr;
                 ptr[n] = val;
+                dval = ptr[n];
                 n++;
             }
         } else {
@@ -221,46 +353,510 @@ long devTextFileRead(const char *filename, void *bptr, dbCommon *prec, int ftvl,
             break;
         }
 
+        // update statistics in the same pass
+        if (stats && n > n0) {
+            devTextFileStatsAdd(stats, dval);
+        }
+
         if (n >= nelm) {
             break;
         }
     }
 
+    // cleanup
+    if (buf) {
+        free(buf);
+        buf = NULL;
+    }
+
+    //
+    return n;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Count lines holding a value, i.e. neither empty, comment nor parse error
+//
+static uint64_t countLines(FILE *fp, const TextFile_t *dpvt)
+{
+    const size_t bufsiz = devTextFileLineLimit(dpvt) + 2; // newline and terminating null
+    const size_t maxbytes = devTextFileByteLimit(dpvt);
+    char *buf = mallocMustSucceed(bufsiz, "malloc for line buffer failed");
+    size_t nbytes = 0;
+    size_t nchars;
+    bool overlong;
+    bool eol;
+    uint64_t count = 0;
+
+    while ((nchars = readLine(fp, buf, bufsiz, maxbytes ? maxbytes - nbytes : SIZE_MAX, &overlong, &eol)) > 0) {
+        nbytes += nchars;
+        char *pbuf = buf;
+
+        // don't count a line truncated by the limit of bytes
+        if (!eol && bytesExceeded(fp, nbytes, maxbytes)) {
+            break;
+        }
+
+        // skip lines exceeding the maximum length.
+        if (overlong) {
+            continue;
+        }
+
+        // skip until non white-space character.
+        while (isspace(*pbuf)) {
+            pbuf ++;
+        }
+
+        // skip empty lines and comments.
+        if (pbuf[0] == 0 || pbuf[0] == '#' || pbuf[0] == ';' || pbuf[0] == '!') {
+            continue;
+        }
+
+        // skip lines which devTextFileParse() rejects for DBF_DOUBLE
+        char *endptr;
+        errno = 0;
+        strtod(pbuf, &endptr);
+        if (errno != 0 || endptr == pbuf) {
+            continue;
+        }
+
+        count ++;
+    }
+
+    // cleanup
+    if (buf) {
+        free(buf);
+        buf = NULL;
+    }
+
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Store value to i-th element of record buffer, rounded and saturated for integer types
+//
+static void storeDouble(void *bptr, int ftvl, uint32_t i, double val)
+{
+#define CLAMP(lo, hi) (!(val >= (lo)) ? (lo) : (val > (hi)) ? (hi) : lrint(val))
+
+    switch (ftvl) {
+    case DBF_CHAR:   ((int8_t   *)bptr)[i] = CLAMP(INT8_MIN,  INT8_MAX);   break;
+    case DBF_UCHAR:  ((uint8_t  *)bptr)[i] = CLAMP(0,         UINT8_MAX);  break;
+    case DBF_SHORT:  ((int16_t  *)bptr)[i] = CLAMP(INT16_MIN, INT16_MAX);  break;
+    case DBF_USHORT: ((uint16_t *)bptr)[i] = CLAMP(0,         UINT16_MAX); break;
+    case DBF_LONG:   ((int32_t  *)bptr)[i] = CLAMP(INT32_MIN, INT32_MAX);  break;
+    case DBF_ULONG:  ((uint32_t *)bptr)[i] = CLAMP(0,         UINT32_MAX); break;
+    case DBF_FLOAT:  ((float    *)bptr)[i] = val; break;
+    case DBF_DOUBLE: ((double   *)bptr)[i] = val; break;
+    }
+
+#undef CLAMP
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Decimate whole file into nelm bins (or nelm/2 bins of min/max pairs).
+// The file is scanned twice: once for counting lines to determine the bin
+// width, and once for parsing values in chunks of bounded size.
+//
+#define DECIMATE_CHUNK 512
+
+static long readDecimate(FILE *fp, const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int *nline, TextFileStats_t *stats, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    const uint32_t nbin = (dpvt->decimate == kDecimMinMax) ? nelm / 2 : nelm;
+    if (nbin == 0) {
+        return 0; // rejected by init_record, but never divide by zero
+    }
+    const uint64_t nlines = countLines(fp, dpvt);
+    const uint64_t width = (nlines + nbin - 1) / nbin;
+
+    rewind(fp);
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): %" PRIu64 " lines into %u bins of %" PRIu64 " lines\n", prec->name, __func__, nlines, nbin, width);
+    }
+
+    //
+    double chunk[DECIMATE_CHUNK];
+    uint32_t n = 0;
+
+    for (uint32_t bin = 0; bin < nbin && width > 0; bin++) {
+        double first = 0;
+        double min = INFINITY;
+        double max = -INFINITY;
+        double sum = 0;
+        uint64_t count = 0;
+
+        while (count < width) {
+            const uint64_t want = (width - count < DECIMATE_CHUNK) ? width - count : DECIMATE_CHUNK;
+            const long m = devTextFileParse(fp, filename, chunk, prec, DBF_DOUBLE, want, nline, stats, debug);
+            if (m <= 0) {
+                break;
+            }
+
+            if (count == 0) {
+                first = chunk[0];
+            }
+
+            for (long i = 0; i < m; i++) {
+                if (chunk[i] < min) {
+                    min = chunk[i];
+                }
+                if (chunk[i] > max) {
+                    max = chunk[i];
+                }
+                sum += chunk[i];
+            }
+            count += m;
+        }
+
+        // reached end-of-file
+        if (count == 0) {
+            break;
+        }
+
+        //
+        if (dpvt->decimate == kDecimStride) {
+            storeDouble(bptr, ftvl, n++, first);
+        } else if (dpvt->decimate == kDecimMean) {
+            storeDouble(bptr, ftvl, n++, sum / count);
+        } else if (dpvt->decimate == kDecimMinMax) {
+            storeDouble(bptr, ftvl, n++, min);
+            storeDouble(bptr, ftvl, n++, max);
+        }
+    }
+
+    //
+    return n;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Find the first line which is neither empty nor comment in null-terminated buf,
+// for files holding a single value. Lines longer than maxline are skipped and
+// counted in *overlong. If truncated is set, the last line without newline is
+// not taken. Returns pointer to the value, or NULL if there is none.
+//
+char *devTextFileFirstValue(char *buf, size_t maxline, bool truncated, uint32_t *overlong)
+{
+    char *line = buf;
+
+    while (*line) {
+        char *eol = strchr(line, '\n');
+        if (eol) {
+            *eol = 0;
+        } else if (truncated) {
+            break; // don't parse a line truncated by the limit of bytes
+        }
+
+        char *pbuf = line;
+        while (isspace(*pbuf)) {
+            pbuf ++;
+        }
+        if (strlen(line) > maxline) {
+            (*overlong) ++;
+        } else if (*pbuf != 0 && *pbuf != '#' && *pbuf != ';' && *pbuf != '!') {
+            return pbuf;
+        }
+
+        line = eol ? eol + 1 : line + strlen(line);
+    }
+
+    return NULL;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Convert the value in the same way as devTextFileParse(), and store it
+// to the index-th element of bptr. The value as stored is added to stats
+// if it is not NULL. Returns false on parse error.
+//
+bool devTextFileStoreValue(const char *pbuf, void *bptr, int ftvl, uint32_t index, TextFileStats_t *stats)
+{
+    char *endptr = (char *)pbuf;
+    long ival = 0;
+    double dval = 0;
+
+    errno = 0;
+    switch (ftvl) {
+    case DBF_STRING: {
+        // pbuf may point into a whole file, so stop at newline like devTextFileParse()
+        char *val = (char *)bptr + index * MAX_STRING_SIZE;
+        size_t len = strnlen(pbuf, MAX_STRING_SIZE-1);
+        const char *eol = memchr(pbuf, '\n', len);
+        if (eol) {
+            len = eol - pbuf;
+        }
+        memcpy(val, pbuf, len);
+        memset(val + len, 0, MAX_STRING_SIZE - len);
+        return true;
+    }
+    case DBF_FLOAT:
+    case DBF_DOUBLE:
+        dval = strtod(pbuf, &endptr);
+        break;
+    default:
+        ival = strtol(pbuf, &endptr, 0);
+        break;
+    }
+    if (errno != 0 || endptr == pbuf) {
+        return false;
+    }
+
+    switch (ftvl) {
+    case DBF_CHAR:   dval = ((int8_t   *)bptr)[index] = ival; break;
+    case DBF_UCHAR:  dval = ((uint8_t  *)bptr)[index] = ival; break;
+    case DBF_SHORT:  dval = ((int16_t  *)bptr)[index] = ival; break;
+    case DBF_USHORT: dval = ((uint16_t *)bptr)[index] = ival; break;
+    case DBF_LONG:   dval = ((int32_t  *)bptr)[index] = ival; break;
+    case DBF_ULONG:  dval = ((uint32_t *)bptr)[index] = ival; break;
+    case DBF_FLOAT:  dval = ((float    *)bptr)[index] = dval; break;
+    case DBF_DOUBLE: dval = ((double   *)bptr)[index] = dval; break;
+    default:
+        return false;
+    }
+
+    if (stats) {
+        devTextFileStatsAdd(stats, dval);
+    }
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Parse the opened file into buffer of ftvl, decimated if configured, and with
+// statistics if stats is not NULL. Counters of this read are reset.
+// Returns number of elements read.
+//
+long devTextFileDecode(FILE *fp, const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, TextFileStats_t *stats, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+
+    // counters for this read
+    dpvt->nbytes = 0;
+    dpvt->overlong = 0;
+    dpvt->capped = false;
+    dpvt->torn = false;
+
+    //
+    if (stats) {
+        devTextFileStatsReset(stats);
+    }
+
+    //
+    int nline = 0;
+    long n = -1;
+    bool advised = false;
+    if (dpvt->sidecar) {
+        n = devTextFileSidecarLoad(fp, bptr, prec, ftvl, nelm, stats, debug); // -1 if not matched
+    }
+
+    if (n < 0) {
+        // page cache policy of large files
+        advised = devTextFileAdviseRead(prec, fp);
+
+        if (dpvt->crc) {
+            n = devTextFileCrcParse(fp, filename, bptr, prec, ftvl, nelm, &nline, stats, debug); // previous values if not matched
+        } else {
+            if (dpvt->parallel) {
+                n = devTextFileParallelParse(fp, filename, bptr, prec, ftvl, nelm, &nline, stats, debug); // -1 for small files
+            }
+            if (n < 0 && dpvt->decimate != kDecimNone) {
+                n = readDecimate(fp, filename, bptr, prec, ftvl, nelm, &nline, stats, debug);
+            } else if (n < 0) {
+                n = devTextFileParse(fp, filename, bptr, prec, ftvl, nelm, &nline, stats, debug);
+            }
+        }
+
+        // values of a complete read, for the next start of IOC
+        if (dpvt->sidecar && n > 0 && dpvt->overlong == 0 && !dpvt->capped && !dpvt->torn) {
+            devTextFileSidecarStore(fp, bptr, prec, ftvl, nelm, n, stats);
+        }
+    }
+
+    // also after a sidecar hit, so that the prefetch is scheduled again
+    devTextFileAdviseDone(prec, fp, advised);
+
+    //
+    return n;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read data from file and fill to record buffer
+//
+static long readFile(const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int debug)
+{
+    //DBLINK *plink = &prec->inp;
+    TextFile_t *dpvt = prec->dpvt;
+    const char *ftvlstr = (pamapdbfType[ftvl].strvalue) + 4;
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): filename: %s ftvl=%s nelm=%d\n", prec->name, "devTextFileRead", filename, ftvlstr, nelm);
+    }
+
+    // latest contents decoded by refresher thread, without system calls
+    if (dpvt->refresh) {
+        return devTextFileRefreshRead(prec, bptr, ftvl, nelm, debug);
+    }
+
+    // latest values received from FIFO or socket by reader thread
+    if (dpvt->stream) {
+        return devTextFileStreamRead(prec, bptr, ftvl, nelm, debug);
+    }
+
+    // values published to shared memory, without system calls
+    if (dpvt->shm) {
+        return devTextFileShmRead(prec, bptr, ftvl, nelm, debug);
+    }
+
+    // single value written by output record in this IOC
+    if (nelm == 1 && dpvt->decimate == kDecimNone && !(dpvt->dostats && dpvt->entry->nstats > 0)) {
+        if (devTextFileCacheRead(prec, bptr, ftvl) > 0) {
+            if (debug > 0) {
+                printf("%s (%s): ret = 1 (cached)\n", prec->name, "devTextFileRead");
+            }
+            return 1;
+        }
+    }
+
+    // file which was missing or unreadable in the last attempt
+    int err = devTextFileNegativeCheck(dpvt->entry);
+    if (err != 0) {
+        if (debug > 0) {
+            printf("%s (%s): ret = -1 (backing off: %s)\n", prec->name, "devTextFileRead", devTextFileStrerror(err));
+        }
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ACCESS_ALARM;
+        return -1;
+    }
+
+    // single value of pseudo-file, parsed without stdio
+    if (dpvt->sysfs && nelm == 1 && dpvt->decimate == kDecimNone && !(dpvt->dostats && dpvt->entry->nstats > 0)) {
+        return devTextFileSysfsRead(filename, bptr, prec, ftvl, debug);
+    }
+
+    // file may have been read together with other records of the same scan period
+    TRACE_BEGIN(prec, kTraceOpen);
+    FILE *fp;
+    if (dpvt->batch) {
+        fp = devTextFileBatchOpen(prec);
+    } else if (dpvt->sysfs) {
+        fp = devTextFileSysfsOpen(prec);
+    } else {
+        fp = devTextFileFopen(dpvt, "r");
+    }
+    err = errno;
+    TRACE_END(prec, kTraceOpen);
+
+    if (fp) {
+        devTextFileNegativeClear(dpvt->entry);
+
+        // modification time for TSE=-2 and TextFile:FRESHNESS, taken by devTextFileBatchOpen() for batch
+        if (dpvt->batch == NULL) {
+            devTextFileFresh(prec, dpvt->sysfs ? devTextFileSysfsFd(dpvt) : fileno(fp));
+        }
+    }
+    if (fp == NULL) {
+        if (devTextFileNegativeFail(dpvt->entry, err)) {
+            TRACE_BEGIN(prec, kTraceErrlog);
+            const char *errmsg = devTextFileStrerror(err);
+            errlogPrintf("%s (%s): can't open \"%s\" for reading: %s\n", prec->name, "devTextFileRead", filename, errmsg);
+            TRACE_END(prec, kTraceErrlog);
+        }
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ACCESS_ALARM;
+        return -1;
+    }
+
+    //
+    TRACE_BEGIN(prec, kTraceParse);
+    TextFileStats_t *stats = (dpvt->dostats && dpvt->entry->nstats > 0) ? &dpvt->stats : NULL; // for companion records
+    long n = devTextFileDecode(fp, filename, bptr, prec, ftvl, nelm, stats, debug);
+    TRACE_END(prec, kTraceParse);
+
     //
     //prec->nord = n; //  number of elements that has been read
-    prec->udf = FALSE;
+    if (n >= 0) {
+        prec->udf = FALSE;
+    }
+
+    // contents didn't match the trailer, previous values have been returned,
+    // or files of the read group kept changing while being read
+    if (dpvt->torn || (dpvt->batch && devTextFileBatchStale(dpvt))) {
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+    }
+
+    // check if any line was skipped or the file was not read to the end
+    if (dpvt->overlong > 0 || dpvt->capped) {
+        dpvt->noverlong += dpvt->overlong;
+        dpvt->ncapped += dpvt->capped;
+
+        TRACE_BEGIN(prec, kTraceErrlog);
+        if (dpvt->overlong > 0) {
+            errlogPrintf("%s (%s): %u line(s) longer than %zu bytes skipped in \"%s\"\n", prec->name, "devTextFileRead", dpvt->overlong, devTextFileLineLimit(dpvt), filename);
+        }
+        if (dpvt->capped) {
+            errlogPrintf("%s (%s): stopped reading \"%s\" after %zu bytes\n", prec->name, "devTextFileRead", filename, dpvt->nbytes);
+        }
+        TRACE_END(prec, kTraceErrlog);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+    }
 
     // check if any data has been read from the input file
     if (n == 0) {
-        errlogPrintf("%s (%s): No data was read from the file: \"%s\"\n", prec->name, __func__, filename);
+        TRACE_BEGIN(prec, kTraceErrlog);
+        errlogPrintf("%s (%s): No data was read from the file: \"%s\"\n", prec->name, "devTextFileRead", filename);
+        TRACE_END(prec, kTraceErrlog);
         prec->nsev = INVALID_ALARM;
         prec->nsta = READ_ALARM;
     }
 
 //    // check if input file reached unexpected end-of-file
 //    if (n < prec->nelm) { // This might be too intolerant. Perhaps we'd better to set severity/status in case of n==0 (i.e. nothing has been read).
-//        errlogPrintf("%s (%s): unexpected end-of-file in \"%s\", line %d.\n", prec->name, __func__, filename, nline);
+//        errlogPrintf("%s (%s): unexpected end-of-file in \"%s\", line %d.\n", prec->name, "devTextFileRead", filename, nline);
 //        prec->nsev = INVALID_ALARM;
 //        prec->nsta = READ_ALARM;
 //        retval = -1;
 //    }
 
     // cleanup
-    if (buf) {
-        free(buf);
-        buf = NULL;
-    }
-
+    TRACE_BEGIN(prec, kTraceClose);
     fclose(fp);
     fp = NULL;
+    if (dpvt->batch) {
+        devTextFileBatchClose(prec);
+    }
+    TRACE_END(prec, kTraceClose);
 
     //
     if (debug > 0) {
-        printf("%s (%s): ret = %d \n", prec->name, __func__, n);
+        printf("%s (%s): ret = %ld \n", prec->name, "devTextFileRead", n);
     }
 
     //
     return n;
 }
 
+// stages are recorded for tracing, see devTextFileTrace.c
+long devTextFileRead(const char *filename, void *bptr, dbCommon *prec, int ftvl, int nelm, int debug)
+{
+    TRACE_BEGIN(prec, kTraceRead);
+    long n = readFile(filename, bptr, prec, ftvl, nelm, debug);
+    TRACE_END(prec, kTraceRead);
+
+    return n;
+}
+
+// Register symbol(s) used by IOC core
+epicsExportAddress(int, devTextFileMaxLine);
+epicsExportAddress(int, devTextFileMaxBytes);
+
 // end
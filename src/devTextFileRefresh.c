@@ -0,0 +1,421 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "alarm.h"
+#include "errlog.h"
+#include "epicsAtomic.h"
+#include "epicsEvent.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "epicsThreadPool.h"
+#include "epicsTime.h"
+
+//
+#include "devTextFile.h"
+
+// shortest refresh period in seconds
+#define REFRESH_MIN 0.001
+
+// contents of the file decoded by a refresh, guarded by seq
+typedef struct {
+    int              seq;       // odd while being written
+    long             n;         // number of elements, or -1 if the file couldn't be read
+    int              err;       // errno if the file couldn't be opened
+    size_t           nbytes;
+    uint32_t         overlong;
+    bool             capped;
+    bool             torn;      // didn't match the trailer, values of the last match are kept
+    bool             hasmtime;
+    struct timespec  mtime;
+    TextFileStats_t  stats;
+    char            *values;    // nelm elements of ftvl
+} snapshot_t;
+
+// refresher of a record, which is attached to TextFile_t
+struct TextFileRefresh {
+    dbCommon        *prec;
+    double           period;    // in seconds
+    int              ftvl;
+    int              nelm;
+    size_t           size;      // bytes per element
+    bool             dostats;
+    epicsJob        *job;
+    int              busy;      // job queued or running, set by the scheduler
+    epicsTimeStamp   next;      // time of the next refresh, guarded by refreshLock
+    snapshot_t       snaps[2];  // one is read by the record while the other is written
+    int              current;   // index of the latest snapshot
+    bool             failing;   // the latest refresh failed, logged only on change
+    uint32_t         nrefresh;  // total number of refreshes, written only by the job
+    uint32_t         nretry;    // total number of copies retried, written only by the record
+};
+
+//
+static TextFileRefresh_t **refreshList = NULL; // guarded by refreshLock
+static int refreshCount = 0;
+static epicsMutexId refreshLock = NULL;
+static epicsEventId refreshWakeup = NULL;
+static epicsThreadOnceId refreshOnce = EPICS_THREAD_ONCE_INIT;
+
+//
+static size_t elementSize(int ftvl)
+{
+    switch (ftvl) {
+    case DBF_STRING: return MAX_STRING_SIZE;
+    case DBF_CHAR:   return sizeof(int8_t);
+    case DBF_UCHAR:  return sizeof(uint8_t);
+    case DBF_SHORT:  return sizeof(int16_t);
+    case DBF_USHORT: return sizeof(uint16_t);
+    case DBF_LONG:   return sizeof(int32_t);
+    case DBF_ULONG:  return sizeof(uint32_t);
+    case DBF_FLOAT:  return sizeof(float);
+    case DBF_DOUBLE: return sizeof(double);
+    }
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Parse info tag TextFile:REFRESH, called from devTextFileConfig()
+//
+long devTextFileRefreshInit(dbCommon *prec, TextFile_t *dpvt, double period)
+{
+    if (period < REFRESH_MIN) {
+        errlogPrintf("%s (%s): TextFile:REFRESH must be %g second(s) or longer\n", prec->name, __func__, REFRESH_MIN);
+        return -1;
+    }
+    if (dpvt->batch || dpvt->sysfs || dpvt->stat != kStatNone) {
+        errlogPrintf("%s (%s): TextFile:REFRESH can't be used with TextFile:BATCH, TextFile:GROUP, TextFile:SYSFS or statistics\n", prec->name, __func__);
+        return -1;
+    }
+
+    TextFileRefresh_t *refresh = devTextFileCalloc(1, sizeof(TextFileRefresh_t), "calloc for refresher failed");
+    refresh->prec = prec;
+    refresh->period = period;
+    dpvt->refresh = refresh;
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read the file and decode it into the snapshot not read by the record, then
+// publish it. Only one refresh of a record runs at a time.
+//
+static void refreshNow(TextFileRefresh_t *refresh)
+{
+    dbCommon *prec = refresh->prec;
+    TextFile_t *dpvt = prec->dpvt;
+    const char *filename = dpvt->name;
+    const int next = 1 - epicsAtomicGetIntT(&refresh->current);
+    snapshot_t *snap = &refresh->snaps[next];
+
+    TRACE_BEGIN(prec, kTraceRead);
+
+    // seq is odd while the snapshot is written
+    epicsAtomicIncrIntT(&snap->seq);
+
+    snap->n = -1;
+    snap->nbytes = 0;
+    snap->overlong = 0;
+    snap->capped = false;
+    snap->torn = false;
+    snap->hasmtime = false;
+
+    // file which was missing or unreadable in the last attempt is not opened
+    FILE *fp = NULL;
+    snap->err = devTextFileNegativeCheck(dpvt->entry);
+    const bool skipped = (snap->err != 0);
+    if (!skipped) {
+        fp = devTextFileFopen(dpvt, "r");
+        snap->err = (fp == NULL) ? errno : 0;
+    }
+
+    if (fp == NULL) {
+        if (!skipped && devTextFileNegativeFail(dpvt->entry, snap->err) && !refresh->failing) {
+            errlogPrintf("%s (%s): can't open \"%s\" for reading: %s\n", prec->name, "devTextFileRefresh", filename, devTextFileStrerror(snap->err));
+        }
+    } else {
+        devTextFileNegativeClear(dpvt->entry);
+
+        struct stat st;
+        if (fstat(fileno(fp), &st) == 0) {
+            snap->mtime = st.st_mtim;
+            snap->hasmtime = true;
+        }
+
+        TRACE_BEGIN(prec, kTraceParse);
+        snap->n = devTextFileDecode(fp, filename, snap->values, prec, refresh->ftvl, refresh->nelm, refresh->dostats ? &snap->stats : NULL, 0);
+        TRACE_END(prec, kTraceParse);
+
+        snap->nbytes = dpvt->nbytes;
+        snap->overlong = dpvt->overlong;
+        snap->capped = dpvt->capped;
+        snap->torn = dpvt->torn;
+        dpvt->noverlong += snap->overlong;
+        dpvt->ncapped += snap->capped;
+        fclose(fp);
+
+        // logged once until the file is read without problems again
+        if ((snap->n == 0 || snap->overlong > 0 || snap->capped) && !refresh->failing) {
+            if (snap->n == 0) {
+                errlogPrintf("%s (%s): No data was read from the file: \"%s\"\n", prec->name, "devTextFileRefresh", filename);
+            }
+            if (snap->overlong > 0) {
+                errlogPrintf("%s (%s): %u line(s) longer than %zu bytes skipped in \"%s\"\n", prec->name, "devTextFileRefresh", snap->overlong, devTextFileLineLimit(dpvt), filename);
+            }
+            if (snap->capped) {
+                errlogPrintf("%s (%s): stopped reading \"%s\" after %zu bytes\n", prec->name, "devTextFileRefresh", filename, snap->nbytes);
+            }
+        }
+    }
+    refresh->failing = (snap->n <= 0 || snap->overlong > 0 || snap->capped || snap->torn);
+
+    // contents are written before seq becomes even, and before the snapshot is published
+    epicsAtomicWriteMemoryBarrier();
+    epicsAtomicIncrIntT(&snap->seq);
+    epicsAtomicSetIntT(&refresh->current, next);
+    refresh->nrefresh ++;
+
+    TRACE_END(prec, kTraceRead);
+}
+
+//
+static void refreshJob(void *arg, epicsJobMode mode)
+{
+    TextFileRefresh_t *refresh = arg;
+
+    if (mode == epicsJobModeRun) {
+        refreshNow(refresh);
+    }
+    epicsAtomicSetIntT(&refresh->busy, 0);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Scheduler thread: queue refreshes of the records when due to the shared
+// thread pool. A record still being refreshed is skipped until the next period.
+//
+static void refreshThread(void *arg)
+{
+    while (true) {
+        epicsTimeStamp now;
+        double wait = 1.0;
+
+        epicsMutexMustLock(refreshLock);
+        epicsTimeGetCurrent(&now);
+        for (int i = 0; i < refreshCount; i++) {
+            TextFileRefresh_t *refresh = refreshList[i];
+
+            double due = epicsTimeDiffInSeconds(&refresh->next, &now);
+            if (due > 0) {
+                wait = (due < wait) ? due : wait;
+                continue;
+            }
+
+            // next refresh is scheduled from the previous one, unless it has fallen behind
+            epicsTimeAddSeconds(&refresh->next, refresh->period);
+            if (epicsTimeDiffInSeconds(&refresh->next, &now) <= 0) {
+                refresh->next = now;
+                epicsTimeAddSeconds(&refresh->next, refresh->period);
+            }
+            wait = (refresh->period < wait) ? refresh->period : wait;
+
+            if (epicsAtomicGetIntT(&refresh->busy)) {
+                continue;
+            }
+            epicsAtomicSetIntT(&refresh->busy, 1);
+            if (epicsJobQueue(refresh->job) != 0) {
+                refreshJob(refresh, epicsJobModeRun); // refresh in this thread
+            }
+        }
+        epicsMutexUnlock(refreshLock);
+
+        // woken up when a record is newly refreshed
+        epicsEventWaitWithTimeout(refreshWakeup, wait);
+    }
+}
+
+//
+static void refreshInit(void *arg)
+{
+    refreshLock = epicsMutexMustCreate();
+    refreshWakeup = epicsEventMustCreate(epicsEventEmpty);
+
+    epicsThreadMustCreate("devTextFileRefresh", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          refreshThread, NULL);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Allocate snapshots for ftvl and nelm of the record, read the file once in
+// this thread, and start refreshing. Called on the first read of the record,
+// as ftvl and nelm are not known to devTextFileConfig().
+//
+static long refreshStart(dbCommon *prec, TextFileRefresh_t *refresh, int ftvl, int nelm)
+{
+    TextFile_t *dpvt = prec->dpvt;
+
+    refresh->ftvl = ftvl;
+    refresh->nelm = nelm;
+    refresh->size = elementSize(ftvl);
+    refresh->dostats = (dpvt->dostats && dpvt->entry->nstats > 0);
+    if (refresh->size == 0) {
+        errlogPrintf("%s (%s): unsuppoted FTVL\n", prec->name, "devTextFileRefresh");
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        refresh->snaps[i].values = devTextFileCalloc(nelm, refresh->size, "calloc for refresh snapshot failed");
+    }
+
+    refresh->job = epicsJobCreate(devTextFileThreadPool(), refreshJob, refresh);
+    if (refresh->job == NULL) {
+        cantProceed("epicsJobCreate for refresher failed");
+    }
+
+    // first snapshot is ready before the record copies it
+    refreshNow(refresh);
+
+    //
+    epicsThreadOnce(&refreshOnce, refreshInit, NULL);
+
+    epicsMutexMustLock(refreshLock);
+    TextFileRefresh_t **list = realloc(refreshList, (refreshCount + 1) * sizeof(TextFileRefresh_t *));
+    if (list == NULL) {
+        cantProceed("realloc for refreshers failed");
+    }
+    refreshList = list;
+    refreshList[refreshCount++] = refresh;
+    epicsTimeGetCurrent(&refresh->next);
+    epicsTimeAddSeconds(&refresh->next, refresh->period);
+    epicsMutexUnlock(refreshLock);
+
+    epicsEventSignal(refreshWakeup);
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Copy the latest snapshot to the record buffer, called from devTextFileRead().
+// No system call is made except on the first read. The copy is retried if the
+// snapshot was overwritten meanwhile, which happens only if the record is
+// preempted for more than a refresh period.
+//
+long devTextFileRefreshRead(dbCommon *prec, void *bptr, int ftvl, int nelm, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileRefresh_t *refresh = dpvt->refresh;
+
+    if (refresh->job == NULL) {
+        if (refreshStart(prec, refresh, ftvl, nelm) != 0) {
+            prec->nsev = INVALID_ALARM;
+            prec->nsta = READ_ALARM;
+            return -1;
+        }
+    } else if (ftvl != refresh->ftvl || nelm > refresh->nelm) {
+        errlogPrintf("%s (%s): FTVL or NELM has been changed\n", prec->name, "devTextFileRefresh");
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+        return -1;
+    }
+
+    //
+    snapshot_t copy;
+    while (true) {
+        const snapshot_t *snap = &refresh->snaps[epicsAtomicGetIntT(&refresh->current)];
+        const int seq = epicsAtomicGetIntT(&snap->seq);
+        if (seq & 1) {
+            refresh->nretry ++;
+            continue;
+        }
+        epicsAtomicReadMemoryBarrier();
+
+        copy = *snap;
+        if (copy.n > 0) {
+            memcpy(bptr, snap->values, copy.n * refresh->size);
+        }
+
+        epicsAtomicReadMemoryBarrier();
+        if (epicsAtomicGetIntT(&snap->seq) == seq) {
+            break;
+        }
+        refresh->nretry ++;
+    }
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): ret = %ld (snapshot)\n", prec->name, "devTextFileRefresh", copy.n);
+    }
+
+    if (copy.n < 0) {
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = copy.torn ? READ_ALARM : READ_ACCESS_ALARM;
+        return -1;
+    }
+
+    // modification time for TSE=-2 and TextFile:FRESHNESS
+    if (copy.hasmtime && (dpvt->age || prec->tse == epicsTimeEventDeviceTime)) {
+        devTextFileFreshTime(prec, &copy.mtime);
+    }
+    if (refresh->dostats) {
+        dpvt->stats = copy.stats;
+    }
+
+    //
+    prec->udf = FALSE;
+
+    if (copy.overlong > 0 || copy.capped || copy.torn) {
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+    }
+    if (copy.n == 0) {
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+    }
+
+    //
+    return copy.n;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report refresher of the record, called from devTextFileReport()
+//
+void devTextFileRefreshReport(const TextFile_t *dpvt)
+{
+    const TextFileRefresh_t *refresh = dpvt->refresh;
+
+    printf("        refreshed every %g second(s): %u refresh(es), %u copy(ies) retried\n", refresh->period, refresh->nrefresh, refresh->nretry);
+}
+
+// end
@@ -0,0 +1,530 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "dbScan.h"
+#include "alarm.h"
+#include "errlog.h"
+#include "epicsAtomic.h"
+#include "epicsEvent.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "epicsTime.h"
+
+//
+#include "devTextFile.h"
+
+// "DTFS" in little endian, and version of the layout below
+#define SHM_MAGIC   0x53465444
+#define SHM_VERSION 1
+
+// attempts to read while the writer is busy, before giving up
+#define SHM_RETRIES 100
+
+// seconds to wait for a change before checking the segment again
+#define SHM_WAIT 1.0
+
+// header at the start of the segment, followed by nelm values of ftvl
+typedef struct {
+    uint32_t magic;     // SHM_MAGIC, set last when the segment is initialized
+    uint16_t version;   // SHM_VERSION
+    uint16_t ftvl;      // type of values, in order of menuFtype (0 STRING, ... 10 DOUBLE)
+    uint32_t nelm;      // capacity of values
+    uint32_t size;      // bytes per value
+    int32_t  seq;       // seqlock, odd while values are being written
+    uint32_t count;     // number of values
+    uint32_t sec;       // epicsTimeStamp of values
+    uint32_t nsec;
+    int32_t  waiters;   // readers sleeping on futex of seq
+    uint8_t  reserved[28];
+} shmHeader_t;
+
+// segment shared by records of the same name, attached to TextFile_t
+struct TextFileShm {
+    const char      *path;      // interned
+    epicsMutexId     lock;      // guards mapping, and serializes writers in this IOC
+    shmHeader_t     *hdr;       // NULL while not mapped
+    size_t           length;    // bytes mapped
+    int              ftvl;      // of the mapped segment
+    uint32_t         nelm;
+    size_t           size;
+    bool             failing;   // error is logged once until the segment is usable again
+    IOSCANPVT        ioscanpvt; // of the file entry
+    epicsEventId     wake;      // wakes up watcher thread when a record is watching
+    int              nwatch;    // number of records with SCAN="I/O Intr"
+    bool             watcher;   // watcher thread has been created
+    uint32_t         nreads;
+    uint32_t         nretries;  // reads repeated as the writer was busy
+    uint32_t         nwrites;
+    uint32_t         nwakeups;  // changes detected by watcher thread
+};
+
+//
+static TextFileShm_t **shmList = NULL; // guarded by listLock
+static int shmCount = 0;
+static epicsMutexId listLock = NULL;
+static epicsThreadOnceId shmOnce = EPICS_THREAD_ONCE_INIT;
+
+//
+static void shmInit(void *arg)
+{
+    listLock = epicsMutexMustCreate();
+}
+
+// wait while *addr is val, or until timeout, across processes
+static void futexWait(int32_t *addr, int32_t val, double timeout)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)timeout;
+    ts.tv_nsec = (long)((timeout - ts.tv_sec) * 1e9);
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+// wake up all readers waiting on *addr, in any process
+static void futexWake(int32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Map the segment, called with s->lock held. If create is true, the segment
+// is created for ftvl and nelm when it doesn't exist yet. Returns NULL on
+// success, or message of the error.
+//
+static const char *shmMap(TextFileShm_t *s, bool create, int ftvl, uint32_t nelm)
+{
+    int fd = shm_open(s->path, create ? (O_RDWR | O_CREAT) : O_RDWR, 0666);
+    if (fd < 0) {
+        return devTextFileStrerror(errno);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        const int err = errno;
+        close(fd);
+        return devTextFileStrerror(err);
+    }
+
+    // new segment, initialized by the first writer
+    bool init = false;
+    if (st.st_size == 0 && create) {
+        st.st_size = sizeof(shmHeader_t) + nelm * dbValueSize(ftvl);
+        if (ftruncate(fd, st.st_size) != 0) {
+            const int err = errno;
+            close(fd);
+            return devTextFileStrerror(err);
+        }
+        init = true;
+    }
+    if ((size_t)st.st_size < sizeof(shmHeader_t)) {
+        close(fd);
+        return "segment is not initialized";
+    }
+
+    //
+    void *addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int err = errno;
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return devTextFileStrerror(err);
+    }
+    shmHeader_t *hdr = addr;
+
+    if (init) {
+        hdr->version = SHM_VERSION;
+        hdr->ftvl = ftvl;
+        hdr->nelm = nelm;
+        hdr->size = dbValueSize(ftvl);
+        epicsAtomicWriteMemoryBarrier();
+        hdr->magic = SHM_MAGIC;
+    }
+
+    // layout is checked once, and trusted afterwards
+    epicsAtomicReadMemoryBarrier();
+    const char *error = NULL;
+    if (hdr->magic != SHM_MAGIC || hdr->version != SHM_VERSION) {
+        error = "unknown layout";
+    } else if (hdr->ftvl > DBF_DOUBLE || hdr->size != dbValueSize(hdr->ftvl) ||
+               sizeof(shmHeader_t) + (size_t)hdr->nelm * hdr->size > (size_t)st.st_size) {
+        error = "broken header";
+    }
+    if (error) {
+        munmap(addr, st.st_size);
+        return error;
+    }
+
+    s->hdr = hdr;
+    s->length = st.st_size;
+    s->ftvl = hdr->ftvl;
+    s->nelm = hdr->nelm;
+    s->size = hdr->size;
+
+    //
+    return NULL;
+}
+
+// map the segment if not yet, logging error once. Returns false on error.
+static bool shmAttach(dbCommon *prec, TextFileShm_t *s, bool create, int ftvl, uint32_t nelm)
+{
+    if (s->hdr) {
+        return true;
+    }
+
+    const char *error = shmMap(s, create, ftvl, nelm);
+    if (error) {
+        if (!s->failing) {
+            errlogPrintf("%s (devTextFileShm): can't map shared memory \"%s\": %s\n", prec->name, s->path, error);
+            s->failing = true;
+        }
+        return false;
+    }
+    s->failing = false;
+
+    //
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Parse info tag TextFile:SHM, called from devTextFileConfig()
+//
+long devTextFileShmInit(dbCommon *prec, TextFile_t *dpvt)
+{
+    if (dpvt->batch || dpvt->sysfs || dpvt->refresh || dpvt->parallel || dpvt->crc || dpvt->poll || dpvt->stream ||
+        dpvt->decimate != kDecimNone || dpvt->stat != kStatNone || dpvt->format != kText) {
+        errlogPrintf("%s (%s): TextFile:SHM can't be used with TextFile:BATCH, TextFile:GROUP, TextFile:SYSFS, TextFile:REFRESH, "
+                     "TextFile:PARALLEL, TextFile:CRC, TextFile:POLL, TextFile:STREAM, TextFile:DECIMATE, statistics or npy format\n",
+                     prec->name, __func__);
+        return -1;
+    }
+
+    // name of shm_open(), e.g. "@/flow"
+    if (dpvt->name[0] != '/' || dpvt->name[1] == 0 || strchr(dpvt->name + 1, '/') || strlen(dpvt->name) > NAME_MAX) {
+        errlogPrintf("%s (%s): name of shared memory must be a single '/' followed by a name, e.g. \"/flow\": \"%s\"\n",
+                     prec->name, __func__, dpvt->name);
+        return -1;
+    }
+
+    //
+    epicsThreadOnce(&shmOnce, shmInit, NULL);
+    epicsMutexMustLock(listLock);
+
+    TextFileShm_t *s = NULL;
+    for (int i = 0; i < shmCount; i++) {
+        if (shmList[i]->path == dpvt->name) { // interned
+            s = shmList[i];
+            break;
+        }
+    }
+
+    if (s == NULL) {
+        TextFileShm_t **list = realloc(shmList, (shmCount + 1) * sizeof(TextFileShm_t *));
+        if (list == NULL) {
+            cantProceed("realloc for shared memory failed");
+        }
+        shmList = list;
+
+        s = devTextFileCalloc(1, sizeof(TextFileShm_t), "calloc for shared memory failed");
+        s->path = dpvt->name;
+        s->lock = epicsMutexMustCreate();
+        s->wake = epicsEventMustCreate(epicsEventEmpty);
+        s->ioscanpvt = dpvt->entry->pollscan;
+        shmList[shmCount++] = s;
+    }
+
+    epicsMutexUnlock(listLock);
+
+    dpvt->shm = s;
+    dpvt->ioscanpvt = s->ioscanpvt;
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Copy values from the segment, called from devTextFileRead(). No system call
+// is made once the segment is mapped, unless the writer keeps it busy.
+// Returns number of elements, or -1 on error.
+//
+long devTextFileShmRead(dbCommon *prec, void *bptr, int ftvl, int nelm, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileShm_t *s = dpvt->shm;
+    TextFileStats_t *stats = (dpvt->dostats && dpvt->entry->nstats > 0) ? &dpvt->stats : NULL;
+
+    epicsMutexMustLock(s->lock);
+    const bool mapped = shmAttach(prec, s, false, ftvl, nelm);
+    epicsMutexUnlock(s->lock);
+    if (!mapped) {
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ACCESS_ALARM;
+        return -1;
+    }
+
+    if (s->ftvl != ftvl) {
+        if (!s->failing) {
+            errlogPrintf("%s (%s): type of shared memory \"%s\" is %d, not %d\n", prec->name, __func__, s->path, s->ftvl, ftvl);
+            s->failing = true;
+        }
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+        return -1;
+    }
+
+    //
+    shmHeader_t *hdr = s->hdr;
+    const char *values = (const char *)(hdr + 1);
+    const uint32_t limit = (s->nelm < (uint32_t)nelm) ? s->nelm : (uint32_t)nelm;
+    uint32_t count = 0;
+    epicsTimeStamp time;
+    bool stable = false;
+
+    for (int i = 0; i < SHM_RETRIES && !stable; i++) {
+        const int seq = epicsAtomicGetIntT(&hdr->seq);
+        if (seq & 1) {
+            s->nretries ++;
+            sched_yield();
+            continue;
+        }
+        epicsAtomicReadMemoryBarrier();
+
+        count = hdr->count;
+        if (count > limit) {
+            count = limit;
+        }
+        time.secPastEpoch = hdr->sec;
+        time.nsec = hdr->nsec;
+        if (stats) {
+            devTextFileStatsReset(stats);
+        }
+        devTextFileStatsCopy(bptr, values, ftvl, s->size, count, stats); // with statistics for companion records
+
+        epicsAtomicReadMemoryBarrier();
+        stable = (epicsAtomicGetIntT(&hdr->seq) == seq);
+        if (!stable) {
+            s->nretries ++;
+        }
+    }
+    s->nreads ++;
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): ret = %u (shared memory%s)\n", prec->name, __func__, count, stable ? "" : ", busy");
+    }
+
+    if (!stable) {
+        if (!s->failing) {
+            errlogPrintf("%s (%s): shared memory \"%s\" kept busy by the writer\n", prec->name, __func__, s->path);
+            s->failing = true;
+        }
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+        return -1;
+    }
+    s->failing = false;
+
+    if (count == 0) {
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+        return -1;
+    }
+
+    // time given by the writer for TSE=-2
+    if (prec->tse == epicsTimeEventDeviceTime) {
+        prec->time = time;
+    }
+    prec->udf = FALSE;
+
+    //
+    return count;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Publish count values of output record to the segment, creating it for ftvl
+// and nelm if it doesn't exist. Writers in this IOC are serialized by the lock
+// of the segment; writers in other processes must not write at the same time.
+//
+long devTextFileShmWrite(dbCommon *prec, const void *bptr, int ftvl, int nelm, int count, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileShm_t *s = dpvt->shm;
+    const char *error = NULL;
+
+    epicsMutexMustLock(s->lock);
+
+    if (!shmAttach(prec, s, true, ftvl, nelm)) {
+        epicsMutexUnlock(s->lock);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = WRITE_ACCESS_ALARM;
+        return -1;
+    }
+
+    if (s->ftvl != ftvl) {
+        error = "type doesn't match";
+    } else if ((uint32_t)count > s->nelm) {
+        error = "segment is too small";
+    } else {
+        shmHeader_t *hdr = s->hdr;
+
+        // odd while being written, even if a writer died in the middle
+        const int seq = epicsAtomicGetIntT(&hdr->seq);
+        const int odd = (seq & 1) ? seq + 2 : seq + 1;
+        epicsAtomicSetIntT(&hdr->seq, odd);
+        epicsAtomicWriteMemoryBarrier();
+
+        memcpy(hdr + 1, bptr, count * s->size);
+        hdr->count = count;
+        hdr->sec = prec->time.secPastEpoch;
+        hdr->nsec = prec->time.nsec;
+
+        epicsAtomicWriteMemoryBarrier();
+        epicsAtomicSetIntT(&hdr->seq, odd + 1);
+        s->nwrites ++;
+
+        // full barrier between seq and waiters, so that no waiter is missed
+        if (epicsAtomicAddIntT(&hdr->waiters, 0) > 0) {
+            futexWake(&hdr->seq);
+        }
+    }
+
+    epicsMutexUnlock(s->lock);
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): %d value(s) to shared memory \"%s\"%s%s\n", prec->name, __func__, count, s->path, error ? ": " : "", error ? error : "");
+    }
+
+    if (error) {
+        if (!s->failing) {
+            errlogPrintf("%s (%s): can't write shared memory \"%s\": %s\n", prec->name, __func__, s->path, error);
+            s->failing = true;
+        }
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = WRITE_ALARM;
+        return -1;
+    }
+    s->failing = false;
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Watcher thread of a segment: sleep on futex of seq while a record is
+// scanned by I/O Intr, and process the records when values are published
+//
+static void shmWatcher(void *arg)
+{
+    TextFileShm_t *s = arg;
+    int last = -1;
+
+    while (true) {
+        if (epicsAtomicGetIntT(&s->nwatch) == 0) {
+            epicsEventMustWait(s->wake);
+            continue;
+        }
+
+        epicsMutexMustLock(s->lock);
+        const bool mapped = (s->hdr != NULL) || shmMap(s, false, 0, 0) == NULL;
+        epicsMutexUnlock(s->lock);
+        if (!mapped) {
+            epicsEventWaitWithTimeout(s->wake, SHM_WAIT);
+            continue;
+        }
+
+        //
+        shmHeader_t *hdr = s->hdr;
+        epicsAtomicIncrIntT(&hdr->waiters);
+        const int seq = epicsAtomicGetIntT(&hdr->seq);
+        if (seq == last || (seq & 1)) {
+            futexWait(&hdr->seq, seq, SHM_WAIT);
+        }
+        epicsAtomicDecrIntT(&hdr->waiters);
+
+        const int now = epicsAtomicGetIntT(&hdr->seq);
+        if (!(now & 1) && now != last) {
+            last = now;
+            s->nwakeups ++;
+            scanIoRequest(s->ioscanpvt);
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Start or stop watching the segment, called from get_ioint_info
+//
+void devTextFileShmWatch(TextFile_t *dpvt, bool watch)
+{
+    TextFileShm_t *s = dpvt->shm;
+
+    epicsMutexMustLock(s->lock);
+    if (!s->watcher) {
+        epicsThreadMustCreate("devTextFileShm", epicsThreadPriorityHigh,
+                              epicsThreadGetStackSize(epicsThreadStackSmall),
+                              shmWatcher, s);
+        s->watcher = true;
+    }
+    epicsMutexUnlock(s->lock);
+
+    if (watch) {
+        epicsAtomicIncrIntT(&s->nwatch);
+    } else {
+        epicsAtomicDecrIntT(&s->nwatch);
+    }
+    epicsEventSignal(s->wake);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report shared memory of the record, called from devTextFileReport()
+//
+void devTextFileShmReport(const TextFile_t *dpvt)
+{
+    const TextFileShm_t *s = dpvt->shm;
+
+    if (s->hdr == NULL) {
+        printf("        shared memory: not mapped\n");
+        return;
+    }
+    printf("        shared memory: type %d, %u value(s), seq %d, %zu bytes mapped\n", s->ftvl, s->nelm, s->hdr->seq, s->length);
+    printf("        reads: %u, repeated as writer was busy: %u, writes: %u, wakeups: %u\n", s->nreads, s->nretries, s->nwrites, s->nwakeups);
+}
+
+// end
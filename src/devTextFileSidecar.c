@@ -0,0 +1,352 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "errlog.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "epicsTime.h"
+#include "epicsExport.h"
+#include "iocsh.h"
+
+//
+#include "devTextFile.h"
+
+// files smaller than this are parsed every time
+static int devTextFileSidecarMin = 65536;
+
+// "DTFSIDE" and version of the layout below
+#define SIDECAR_MAGIC   "DTFSIDE"
+#define SIDECAR_VERSION 1
+
+// header of the sidecar file, followed by the name of the source and the values
+typedef struct {
+    char            magic[8];
+    uint32_t        version;
+    uint16_t        ftvl;
+    uint16_t        decimate;
+    uint32_t        nelm;       // of the record
+    uint32_t        count;      // number of values stored
+    uint64_t        maxline;    // limits used for parsing
+    uint64_t        maxbytes;
+    uint64_t        dev;        // identity of the source when parsed
+    uint64_t        ino;
+    int64_t         size;
+    int64_t         mtime;
+    int64_t         mtimensec;
+    uint32_t        namelen;    // length of the name of the source which follows
+    uint32_t        hasstats;
+    TextFileStats_t stats;
+} sidecarHeader_t;
+
+// sidecar of a record, attached to TextFile_t
+struct TextFileSidecar {
+    char           *path;       // of the sidecar file, NULL until the directory is given
+    bool            failing;    // error is logged once until a sidecar is written
+    uint32_t        nhits;      // reads served by the sidecar
+    uint32_t        nmisses;    // reads parsed as the sidecar didn't match the source
+    uint32_t        nstores;    // sidecars written
+};
+
+//
+static char *sidecarDir = NULL; // guarded by dirLock
+static epicsMutexId dirLock = NULL;
+static epicsThreadOnceId sidecarOnce = EPICS_THREAD_ONCE_INIT;
+
+//
+static void sidecarInit(void *arg)
+{
+    dirLock = epicsMutexMustCreate();
+}
+
+//
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t len)
+{
+    for (const unsigned char *p = data; len > 0; p++, len--) {
+        hash = (hash ^ *p) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// path of the sidecar file, by FNV-1a hash of the name of the source and how
+// it is parsed, so that records parsing the same file differently don't share it
+static char *sidecarPath(const TextFile_t *dpvt, int ftvl, int nelm)
+{
+    epicsThreadOnce(&sidecarOnce, sidecarInit, NULL);
+
+    const uint64_t params[] = { ftvl, nelm, dpvt->decimate, devTextFileLineLimit(dpvt), devTextFileByteLimit(dpvt) };
+
+    epicsMutexMustLock(dirLock);
+    char *path = NULL;
+    if (sidecarDir) {
+        uint64_t hash = fnv1a(0xcbf29ce484222325ULL, dpvt->name, strlen(dpvt->name));
+        hash = fnv1a(hash, params, sizeof(params));
+        if (asprintf(&path, "%s/%016llx.bin", sidecarDir, (unsigned long long)hash) < 0) {
+            cantProceed("asprintf for sidecar failed");
+        }
+    }
+    epicsMutexUnlock(dirLock);
+
+    return path;
+}
+
+// fill the header for the source just opened, returns false if it can't be stat()ed
+static bool sidecarKey(sidecarHeader_t *hdr, FILE *fp, const TextFile_t *dpvt, int ftvl, int nelm)
+{
+    struct stat st;
+
+    if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, SIDECAR_MAGIC, sizeof(hdr->magic));
+    hdr->version   = SIDECAR_VERSION;
+    hdr->ftvl      = ftvl;
+    hdr->decimate  = dpvt->decimate;
+    hdr->nelm      = nelm;
+    hdr->maxline   = devTextFileLineLimit(dpvt);
+    hdr->maxbytes  = devTextFileByteLimit(dpvt);
+    hdr->dev       = st.st_dev;
+    hdr->ino       = st.st_ino;
+    hdr->size      = st.st_size;
+    hdr->mtime     = st.st_mtim.tv_sec;
+    hdr->mtimensec = st.st_mtim.tv_nsec;
+    hdr->namelen   = strlen(dpvt->name);
+
+    return true;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Parse info tag TextFile:SIDECAR, called from devTextFileConfig()
+//
+long devTextFileSidecarInit(dbCommon *prec, TextFile_t *dpvt)
+{
+    if (dpvt->batch || dpvt->sysfs || dpvt->crc || dpvt->stream || dpvt->shm || dpvt->format != kText) {
+        errlogPrintf("%s (%s): TextFile:SIDECAR can't be used with TextFile:BATCH, TextFile:GROUP, TextFile:SYSFS, "
+                     "TextFile:CRC, TextFile:STREAM, TextFile:SHM or npy format\n", prec->name, __func__);
+        return -1;
+    }
+
+    dpvt->sidecar = devTextFileCalloc(1, sizeof(TextFileSidecar_t), "calloc for sidecar failed");
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Take values from the sidecar if it matches the source just opened, called
+// from devTextFileDecode(). Returns number of elements, or -1 if the source
+// has to be parsed.
+//
+long devTextFileSidecarLoad(FILE *fp, void *bptr, dbCommon *prec, int ftvl, int nelm, TextFileStats_t *stats, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileSidecar_t *sc = dpvt->sidecar;
+    sidecarHeader_t key, hdr;
+
+    if (sc->path == NULL && (sc->path = sidecarPath(dpvt, ftvl, nelm)) == NULL) {
+        return -1; // no directory
+    }
+    if (!sidecarKey(&key, fp, dpvt, ftvl, nelm) || key.size < devTextFileSidecarMin) {
+        return -1;
+    }
+
+    //
+    int fd = open(sc->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        sc->nmisses ++;
+        return -1;
+    }
+
+    char name[key.namelen];
+    struct iovec iov[2] = { { &hdr, sizeof(hdr) }, { name, key.namelen } };
+    const ssize_t len = sizeof(hdr) + key.namelen;
+
+    bool match = (preadv(fd, iov, 2, 0) == len &&
+                  memcmp(&hdr, &key, offsetof(sidecarHeader_t, count)) == 0 &&
+                  memcmp(&hdr.maxline, &key.maxline, offsetof(sidecarHeader_t, hasstats) - offsetof(sidecarHeader_t, maxline)) == 0 &&
+                  memcmp(name, dpvt->name, key.namelen) == 0 &&
+                  hdr.count <= (uint32_t)nelm &&
+                  (stats == NULL || hdr.hasstats));
+
+    const size_t size = hdr.count * dbValueSize(ftvl);
+    if (match && size > 0) {
+        match = (pread(fd, bptr, size, len) == (ssize_t)size);
+    }
+    close(fd);
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): %s \"%s\"\n", prec->name, __func__, match ? "taken from" : "doesn't match", sc->path);
+    }
+
+    if (!match) {
+        sc->nmisses ++;
+        return -1;
+    }
+    sc->nhits ++;
+
+    if (stats) {
+        *stats = hdr.stats;
+    }
+
+    //
+    return hdr.count;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Store values just parsed from the source, called from devTextFileDecode().
+// Written to a temporary file and renamed, so that another IOC reading the
+// same sidecar never sees it half-written.
+//
+void devTextFileSidecarStore(FILE *fp, const void *bptr, dbCommon *prec, int ftvl, int nelm, long n, const TextFileStats_t *stats)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileSidecar_t *sc = dpvt->sidecar;
+    sidecarHeader_t hdr;
+
+    if (sc->path == NULL || !sidecarKey(&hdr, fp, dpvt, ftvl, nelm) || hdr.size < devTextFileSidecarMin) {
+        return;
+    }
+
+    // the source may still be written within the resolution of its modification time
+    epicsTimeStamp now;
+    epicsTimeGetCurrent(&now);
+    if (now.secPastEpoch + POSIX_TIME_AT_EPICS_EPOCH <= hdr.mtime + 1) {
+        return;
+    }
+
+    hdr.count = n;
+    if (stats) {
+        hdr.hasstats = 1;
+        hdr.stats = *stats;
+    }
+
+    //
+    char tmp[strlen(sc->path) + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", sc->path, (int)getpid());
+
+    const char *error = NULL;
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = devTextFileStrerror(errno);
+    } else {
+        struct iovec iov[3] = { { &hdr, sizeof(hdr) }, { (void *)dpvt->name, hdr.namelen }, { (void *)bptr, n * dbValueSize(ftvl) } };
+        const ssize_t len = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+
+        if (writev(fd, iov, 3) != len) {
+            error = devTextFileStrerror(errno);
+        }
+        if (close(fd) != 0 && error == NULL) {
+            error = devTextFileStrerror(errno);
+        }
+        if (error == NULL && rename(tmp, sc->path) != 0) {
+            error = devTextFileStrerror(errno);
+        }
+        if (error) {
+            unlink(tmp);
+        }
+    }
+
+    //
+    if (error) {
+        if (!sc->failing) {
+            errlogPrintf("%s (%s): can't write sidecar \"%s\": %s\n", prec->name, __func__, sc->path, error);
+            sc->failing = true;
+        }
+        return;
+    }
+    sc->failing = false;
+    sc->nstores ++;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report sidecar of the record, called from devTextFileReport()
+//
+void devTextFileSidecarReport(const TextFile_t *dpvt)
+{
+    const TextFileSidecar_t *sc = dpvt->sidecar;
+
+    printf("        sidecar %s: %u hit(s), %u miss(es), %u store(s)\n", sc->path ? sc->path : "(no directory)", sc->nhits, sc->nmisses, sc->nstores);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Set directory of sidecar files, before iocInit
+//
+long devTextFileSidecarDir(const char *dir)
+{
+    epicsThreadOnce(&sidecarOnce, sidecarInit, NULL);
+
+    struct stat st;
+    if (dir && *dir && (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode))) {
+        errlogPrintf("devTextFileSidecarDir: \"%s\" is not a directory\n", dir);
+        return -1;
+    }
+
+    epicsMutexMustLock(dirLock);
+    free(sidecarDir);
+    sidecarDir = (dir && *dir) ? strdup(dir) : NULL;
+    epicsMutexUnlock(dirLock);
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// iocsh command
+//
+static const iocshArg sidecarDirArg0 = { "directory", iocshArgString };
+static const iocshArg * const sidecarDirArgs[] = { &sidecarDirArg0 };
+static const iocshFuncDef sidecarDirDef = { "devTextFileSidecarDir", 1, sidecarDirArgs };
+
+static void sidecarDirCall(const iocshArgBuf *args)
+{
+    devTextFileSidecarDir(args[0].sval);
+}
+
+static void devTextFileSidecarRegister(void)
+{
+    iocshRegister(&sidecarDirDef, sidecarDirCall);
+}
+
+// Register symbol(s) used by IOC core
+epicsExportAddress(int, devTextFileSidecarMin);
+epicsExportRegistrar(devTextFileSidecarRegister);
+
+// end
@@ -0,0 +1,505 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "dbScan.h"
+#include "alarm.h"
+#include "errlog.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "epicsTime.h"
+
+//
+#include "devTextFile.h"
+
+// seconds between attempts to open an endpoint which is missing or closed
+#define STREAM_RETRY 1.0
+
+// bytes taken by a single read() from an endpoint
+#define STREAM_BUFSIZ 65536
+
+// FIFO or Unix domain socket, shared by records of the same path
+typedef struct {
+    const char      *path;      // interned, see devTextFileIntern()
+    int              fd;        // -1 while not connected, guarded by lock
+    bool             socket;    // connected to a socket rather than opened FIFO
+    epicsMutexId     lock;      // guards values of the members
+    IOSCANPVT        ioscanpvt; // of the file entry, shared by records of the path
+    char            *line;      // line being received
+    size_t           len;
+    size_t           maxline;   // longest of limits of the members
+    bool             overlong;  // rest of an overlong line is being discarded
+    bool             failing;   // error is logged once until something is received again
+    epicsTimeStamp   retry;     // next attempt to connect, used only by the reader thread
+    epicsTimeStamp   time;      // arrival of the latest line
+    TextFileStream_t **members;
+    int              nmembers;
+    uint32_t         nconnect;  // number of connections
+    uint32_t         nlines;    // number of lines holding values
+    uint32_t         noverlong; // number of lines skipped as too long
+} stream_t;
+
+// values of a record received from the endpoint, attached to TextFile_t
+struct TextFileStream {
+    stream_t        *stream;
+    int              ftvl;
+    int              nelm;
+    size_t           size;      // bytes per element
+    char            *ring;      // latest nelm values, guarded by stream->lock
+    uint32_t         head;      // index of the next value
+    uint32_t         count;     // number of values in ring
+    bool             error;     // a line couldn't be parsed since the last read
+    uint32_t         nvalues;   // number of values received
+    uint32_t         nerrors;   // number of lines which couldn't be parsed
+};
+
+//
+static stream_t **streamList = NULL; // guarded by listLock
+static int streamCount = 0;
+static epicsMutexId listLock = NULL;
+static int epfd = -1;
+static epicsThreadOnceId streamOnce = EPICS_THREAD_ONCE_INIT;
+
+/////////////////////////////////////////////////////////////////
+//
+// Open FIFO, or connect to socket, and watch it by epoll.
+// Called only by the reader thread, except for the first attempt.
+//
+static int streamConnect(stream_t *s)
+{
+    struct stat st;
+    int fd = -1;
+
+    if (stat(s->path, &st) != 0) {
+        return -1;
+    }
+
+    if (S_ISFIFO(st.st_mode)) {
+        // opened also for writing, so that read() doesn't return end-of-file while no writer is there
+        fd = open(s->path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        s->socket = false;
+    } else if (S_ISSOCK(st.st_mode)) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(s->path) >= sizeof(addr.sun_path)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(addr.sun_path, s->path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            const int err = errno;
+            close(fd);
+            errno = err;
+            return -1;
+        }
+        if (fd >= 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        }
+        s->socket = true;
+    } else {
+        errno = EINVAL; // neither FIFO nor socket
+        return -1;
+    }
+    if (fd < 0) {
+        return -1;
+    }
+
+    //
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = s;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        const int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    epicsMutexMustLock(s->lock);
+    s->fd = fd;
+    s->len = 0;
+    s->overlong = false;
+    s->nconnect ++;
+    epicsMutexUnlock(s->lock);
+
+    return 0;
+}
+
+// close the endpoint and try again later
+static void streamClose(stream_t *s, int err)
+{
+    epoll_ctl(epfd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+
+    epicsMutexMustLock(s->lock);
+    s->fd = -1;
+    epicsMutexUnlock(s->lock);
+
+    if (!s->failing) {
+        if (err != 0) {
+            errlogPrintf("devTextFileStream: \"%s\" closed: %s\n", s->path, devTextFileStrerror(err));
+        } else {
+            errlogPrintf("devTextFileStream: \"%s\" closed by the peer\n", s->path);
+        }
+        s->failing = true;
+    }
+
+    // members are processed, so that the alarm is raised
+    scanIoRequest(s->ioscanpvt);
+
+    epicsTimeGetCurrent(&s->retry);
+    epicsTimeAddSeconds(&s->retry, STREAM_RETRY);
+}
+
+// store a line holding a value to the members, called with s->lock held
+static void streamLine(stream_t *s, const char *pbuf)
+{
+    s->nlines ++;
+
+    for (int i = 0; i < s->nmembers; i++) {
+        TextFileStream_t *m = s->members[i];
+
+        if (devTextFileStoreValue(pbuf, m->ring, m->ftvl, m->head, NULL)) {
+            m->head = (m->head + 1) % m->nelm;
+            if (m->count < (uint32_t)m->nelm) {
+                m->count ++;
+            }
+            m->nvalues ++;
+        } else {
+            m->error = true;
+            m->nerrors ++;
+        }
+    }
+}
+
+// split received bytes into lines, which are checked by the same rules as devTextFileParse()
+static void streamBytes(stream_t *s, const char *buf, size_t len)
+{
+    epicsMutexMustLock(s->lock);
+
+    while (len > 0) {
+        const char *eol = memchr(buf, '\n', len);
+        const size_t n = eol ? (size_t)(eol - buf) : len;
+
+        // characters which don't fit are discarded without buffering
+        if (s->len + n > s->maxline) {
+            s->overlong = true;
+        } else {
+            memcpy(s->line + s->len, buf, n);
+            s->len += n;
+        }
+        if (eol == NULL) {
+            break;
+        }
+        buf += n + 1;
+        len -= n + 1;
+
+        //
+        s->line[s->len] = 0;
+        if (s->overlong) {
+            s->noverlong ++;
+        } else {
+            char *pbuf = s->line;
+            while (isspace(*pbuf)) {
+                pbuf ++;
+            }
+            if (*pbuf != 0 && *pbuf != '#' && *pbuf != ';' && *pbuf != '!') {
+                streamLine(s, pbuf);
+            }
+        }
+        s->len = 0;
+        s->overlong = false;
+    }
+
+    epicsTimeGetCurrent(&s->time);
+    s->failing = false;
+    epicsMutexUnlock(s->lock);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Reader thread: receive lines from all endpoints, and process the records
+// once for the lines taken by a single read()
+//
+static void streamThread(void *arg)
+{
+    struct epoll_event events[64];
+    char *buf = mallocMustSucceed(STREAM_BUFSIZ, "malloc for stream buffer failed");
+
+    while (true) {
+        // endpoints which are missing or have been closed
+        epicsTimeStamp now;
+        epicsTimeGetCurrent(&now);
+
+        epicsMutexMustLock(listLock);
+        for (int i = 0; i < streamCount; i++) {
+            stream_t *s = streamList[i];
+            if (s->fd < 0 && epicsTimeDiffInSeconds(&now, &s->retry) >= 0) {
+                if (streamConnect(s) != 0) {
+                    if (!s->failing) {
+                        errlogPrintf("devTextFileStream: can't open \"%s\": %s\n", s->path, devTextFileStrerror(errno));
+                        s->failing = true;
+                    }
+                    s->retry = now;
+                    epicsTimeAddSeconds(&s->retry, STREAM_RETRY);
+                }
+            }
+        }
+        epicsMutexUnlock(listLock);
+
+        //
+        int n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), (int)(STREAM_RETRY * 1000));
+        if (n < 0) {
+            if (errno != EINTR) {
+                errlogPrintf("devTextFileStream: epoll_wait failed: %s\n", devTextFileStrerror(errno));
+                epicsThreadSleep(STREAM_RETRY);
+            }
+            continue;
+        }
+
+        for (int i = 0; i < n; i++) {
+            stream_t *s = events[i].data.ptr;
+
+            ssize_t ret = read(s->fd, buf, STREAM_BUFSIZ);
+            if (ret > 0) {
+                streamBytes(s, buf, ret);
+                scanIoRequest(s->ioscanpvt);
+            } else if (ret == 0) {
+                streamClose(s, 0);
+            } else if (errno != EAGAIN && errno != EINTR) {
+                streamClose(s, errno);
+            }
+        }
+    }
+}
+
+//
+static void streamInit(void *arg)
+{
+    listLock = epicsMutexMustCreate();
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        cantProceed("epoll_create1 for stream failed");
+    }
+
+    epicsThreadMustCreate("devTextFileStream", epicsThreadPriorityHigh,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          streamThread, NULL);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Parse info tag TextFile:STREAM, called from devTextFileConfig()
+//
+long devTextFileStreamInit(dbCommon *prec, TextFile_t *dpvt)
+{
+    if (dpvt->flag == kRead || dpvt->batch || dpvt->sysfs || dpvt->refresh || dpvt->parallel || dpvt->crc || dpvt->poll ||
+        dpvt->decimate != kDecimNone || dpvt->stat != kStatNone) {
+        errlogPrintf("%s (%s): TextFile:STREAM can't be used with '<', TextFile:BATCH, TextFile:GROUP, TextFile:SYSFS, TextFile:REFRESH, "
+                     "TextFile:PARALLEL, TextFile:CRC, TextFile:POLL, TextFile:DECIMATE or statistics\n", prec->name, __func__);
+        return -1;
+    }
+
+    dpvt->stream = devTextFileCalloc(1, sizeof(TextFileStream_t), "calloc for stream failed");
+    dpvt->ioscanpvt = dpvt->entry->pollscan;
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Allocate ring of values for ftvl and nelm of the record, and start receiving
+// from the endpoint. Called from init_record, after devTextFileConfig().
+//
+long devTextFileStreamStart(dbCommon *prec, int ftvl, int nelm)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileStream_t *m = dpvt->stream;
+
+    epicsThreadOnce(&streamOnce, streamInit, NULL);
+
+    m->ftvl = ftvl;
+    m->nelm = nelm;
+    m->size = dbValueSize(ftvl);
+    m->ring = devTextFileCalloc(nelm, m->size, "calloc for stream values failed");
+
+    //
+    epicsMutexMustLock(listLock);
+
+    stream_t *s = NULL;
+    for (int i = 0; i < streamCount; i++) {
+        if (streamList[i]->path == dpvt->name) { // interned
+            s = streamList[i];
+            break;
+        }
+    }
+
+    if (s == NULL) {
+        stream_t **list = realloc(streamList, (streamCount + 1) * sizeof(stream_t *));
+        if (list == NULL) {
+            cantProceed("realloc for streams failed");
+        }
+        streamList = list;
+
+        s = devTextFileCalloc(1, sizeof(stream_t), "calloc for stream failed");
+        s->path = dpvt->name;
+        s->fd = -1;
+        s->lock = epicsMutexMustCreate();
+        s->ioscanpvt = dpvt->entry->pollscan;
+        streamList[streamCount++] = s;
+    }
+
+    epicsMutexMustLock(s->lock);
+    TextFileStream_t **members = realloc(s->members, (s->nmembers + 1) * sizeof(TextFileStream_t *));
+    if (members == NULL) {
+        cantProceed("realloc for stream members failed");
+    }
+    s->members = members;
+    s->members[s->nmembers++] = m;
+    m->stream = s;
+
+    const size_t maxline = devTextFileLineLimit(dpvt);
+    if (maxline > s->maxline) {
+        char *line = realloc(s->line, maxline + 1);
+        if (line == NULL) {
+            cantProceed("realloc for stream line failed");
+        }
+        s->line = line;
+        s->maxline = maxline;
+    }
+    epicsMutexUnlock(s->lock);
+
+    // first attempt in this thread, so that values sent right after iocInit are not missed
+    if (s->nmembers == 1 && streamConnect(s) != 0) {
+        errlogPrintf("%s (%s): can't open \"%s\" yet, trying again in background: %s\n", prec->name, __func__, s->path, devTextFileStrerror(errno));
+        s->failing = true;
+        epicsTimeGetCurrent(&s->retry);
+        epicsTimeAddSeconds(&s->retry, STREAM_RETRY);
+    }
+
+    epicsMutexUnlock(listLock);
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Copy the latest values received, oldest first, called from devTextFileRead().
+// Statistics for companion records are taken while copying. No system call is made. Returns number of elements, or -1 if none has been received.
+//
+long devTextFileStreamRead(dbCommon *prec, void *bptr, int ftvl, int nelm, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    TextFileStream_t *m = dpvt->stream;
+    stream_t *s = m->stream;
+    TextFileStats_t *stats = (dpvt->dostats && dpvt->entry->nstats > 0) ? &dpvt->stats : NULL;
+
+    if (ftvl != m->ftvl || nelm > m->nelm) {
+        errlogPrintf("%s (%s): FTVL or NELM has been changed\n", prec->name, __func__);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+        return -1;
+    }
+
+    //
+    epicsMutexMustLock(s->lock);
+
+    const long n = m->count;
+    if (stats) {
+        devTextFileStatsReset(stats);
+    }
+    if (n > 0) {
+        const uint32_t first = (m->head + m->nelm - m->count) % m->nelm;
+        const uint32_t tail = (first + n > (uint32_t)m->nelm) ? m->nelm - first : n;
+        devTextFileStatsCopy(bptr, m->ring + first * m->size, ftvl, m->size, tail, stats);
+        devTextFileStatsCopy((char *)bptr + tail * m->size, m->ring, ftvl, m->size, n - tail, stats);
+    }
+    const bool error = m->error;
+    const bool connected = (s->fd >= 0);
+    const epicsTimeStamp time = s->time;
+    m->error = false;
+
+    epicsMutexUnlock(s->lock);
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): ret = %ld (stream%s)\n", prec->name, __func__, n, connected ? "" : ", not connected");
+    }
+
+    if (error) {
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+    }
+    if (!connected) {
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ACCESS_ALARM;
+    }
+    if (n == 0) {
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = connected ? READ_ALARM : READ_ACCESS_ALARM;
+        return -1;
+    }
+
+    // time of arrival for TSE=-2
+    if (prec->tse == epicsTimeEventDeviceTime) {
+        prec->time = time;
+    }
+    prec->udf = FALSE;
+
+    //
+    return n;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Report stream of the record, called from devTextFileReport()
+//
+void devTextFileStreamReport(const TextFile_t *dpvt)
+{
+    const TextFileStream_t *m = dpvt->stream;
+    const stream_t *s = m->stream;
+
+    if (s == NULL) {
+        return;
+    }
+    printf("        stream from %s: %s, %u connection(s), %u line(s), %u overlong\n",
+           s->socket ? "socket" : "FIFO", (s->fd >= 0) ? "connected" : "not connected", s->nconnect, s->nlines, s->noverlong);
+    printf("        values: %u received, %u couldn't be parsed, %u in buffer\n", m->nvalues, m->nerrors, m->count);
+}
+
+// end
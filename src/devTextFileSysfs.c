@@ -0,0 +1,368 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "dbScan.h"
+#include "alarm.h"
+#include "errlog.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+
+//
+#include "devTextFile.h"
+
+// size of read buffer, attributes of sysfs don't exceed a page
+#define SYSFS_BUFSIZ 4096
+
+// pseudo-file kept open by a record, attached to TextFile_t
+struct TextFileSysfs {
+    int              fd;        // -1 if it couldn't be opened, opened again on the next read
+    char            *buf;       // contents of the latest read, null-terminated
+    size_t           siz;
+};
+
+// file watched for sysfs_notify()
+typedef struct {
+    TextFileEntry_t *entry;
+    int              fd;        // opened separately from the records
+    int              count;     // number of records in I/O Intr scan
+} watch_t;
+
+//
+static watch_t *watchList = NULL; // guarded by watchLock
+static int watchCount = 0;
+static epicsMutexId watchLock = NULL;
+static int watchPipe[2] = { -1, -1 }; // wakes up the notifier when watchList is changed
+static epicsThreadOnceId watchOnce = EPICS_THREAD_ONCE_INIT;
+
+/////////////////////////////////////////////////////////////////
+//
+// Open the pseudo-file and allocate read buffer, called from devTextFileConfig().
+// The file is kept open, and opened again on the next read if it can't be opened now.
+//
+long devTextFileSysfsInit(dbCommon *prec, TextFile_t *dpvt)
+{
+    const size_t maxbytes = devTextFileByteLimit(dpvt);
+
+    dpvt->sysfs = devTextFileCalloc(1, sizeof(TextFileSysfs_t), "calloc for sysfs failed");
+    dpvt->sysfs->siz = (maxbytes > 0 && maxbytes < SYSFS_BUFSIZ) ? maxbytes + 1 : SYSFS_BUFSIZ;
+    dpvt->sysfs->buf = mallocMustSucceed(dpvt->sysfs->siz + 1, "malloc for sysfs buffer failed"); // terminating null
+
+    dpvt->sysfs->fd = open(dpvt->name, O_RDONLY | O_CLOEXEC);
+    if (dpvt->sysfs->fd < 0) {
+        const char *errmsg = devTextFileStrerror(errno);
+        errlogPrintf("%s (%s): can't open \"%s\" for reading: %s\n", prec->name, __func__, dpvt->name, errmsg);
+    }
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read contents from offset 0 into the buffer. A single pread() is enough for
+// attributes of sysfs, while procfs files may return a page at a time and are
+// read until end-of-file if whole is set. The buffer grows only if the file
+// doesn't fit. Returns number of bytes read, or -1 with errno set.
+//
+static ssize_t readAll(TextFile_t *dpvt, bool whole)
+{
+    const size_t maxbytes = devTextFileByteLimit(dpvt);
+    size_t len = 0;
+
+    if (dpvt->sysfs->fd < 0) {
+        dpvt->sysfs->fd = open(dpvt->name, O_RDONLY | O_CLOEXEC);
+        if (dpvt->sysfs->fd < 0) {
+            return -1;
+        }
+    }
+
+    while (true) {
+        ssize_t ret = pread(dpvt->sysfs->fd, dpvt->sysfs->buf + len, dpvt->sysfs->siz - len, len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // the device may have been removed, open the file again next time
+            const int err = errno;
+            close(dpvt->sysfs->fd);
+            dpvt->sysfs->fd = -1;
+            errno = err;
+            return -1;
+        }
+        len += ret;
+
+        if (ret == 0 || (!whole && len < dpvt->sysfs->siz)) {
+            break;
+        }
+        if (len < dpvt->sysfs->siz) {
+            continue;
+        }
+
+        // one more byte than the limit, so that it can be told that the limit was reached
+        if (maxbytes > 0 && dpvt->sysfs->siz > maxbytes) {
+            break;
+        }
+
+        size_t size = dpvt->sysfs->siz * 2;
+        if (maxbytes > 0 && size > maxbytes + 1) {
+            size = maxbytes + 1;
+        }
+        dpvt->sysfs->buf = realloc(dpvt->sysfs->buf, size + 1);
+        if (dpvt->sysfs->buf == NULL) {
+            cantProceed("realloc for sysfs buffer failed");
+        }
+        dpvt->sysfs->siz = size;
+    }
+
+    dpvt->sysfs->buf[len] = 0;
+
+    return len;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Read single value from the pseudo-file kept open, without stdio.
+// Returns 1 on success, or -1 on error with alarm set.
+//
+long devTextFileSysfsRead(const char *filename, void *bptr, dbCommon *prec, int ftvl, int debug)
+{
+    TextFile_t *dpvt = prec->dpvt;
+    const size_t maxline = devTextFileLineLimit(dpvt);
+    const size_t maxbytes = devTextFileByteLimit(dpvt);
+
+    //
+    ssize_t len = readAll(dpvt, false);
+    if (len < 0) {
+        const int err = errno;
+        if (devTextFileNegativeFail(dpvt->entry, err)) {
+            const char *errmsg = devTextFileStrerror(err);
+            errlogPrintf("%s (%s): can't read \"%s\": %s\n", prec->name, __func__, filename, errmsg);
+        }
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ACCESS_ALARM;
+        return -1;
+    }
+
+    devTextFileNegativeClear(dpvt->entry);
+    devTextFileFresh(prec, dpvt->sysfs->fd);
+
+    // counters for this read
+    dpvt->overlong = 0;
+    dpvt->capped = (maxbytes > 0 && (size_t)len > maxbytes);
+    dpvt->nbytes = dpvt->capped ? maxbytes : (size_t)len;
+    dpvt->sysfs->buf[dpvt->nbytes] = 0;
+
+    // first line which is neither empty nor comment
+    char *value = devTextFileFirstValue(dpvt->sysfs->buf, maxline, dpvt->capped, &dpvt->overlong);
+
+    //
+    if (debug > 0) {
+        printf("%s (%s): %zd bytes, value: %s\n", prec->name, __func__, len, value ? value : "(none)");
+    }
+
+    // check if any line was skipped or the file was not read to the end
+    if (dpvt->overlong > 0 || dpvt->capped) {
+        dpvt->noverlong += dpvt->overlong;
+        dpvt->ncapped += dpvt->capped;
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+    }
+
+    if (value == NULL || !devTextFileStoreValue(value, bptr, ftvl, 0, NULL)) {
+        errlogPrintf("%s (%s): No data was read from the file: \"%s\"\n", prec->name, __func__, filename);
+        prec->nsev = INVALID_ALARM;
+        prec->nsta = READ_ALARM;
+        return -1;
+    }
+
+    //
+    prec->udf = FALSE;
+
+    //
+    return 1;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Open whole contents of the pseudo-file for devTextFileParse(), used for waveform
+//
+FILE *devTextFileSysfsOpen(dbCommon *prec)
+{
+    TextFile_t *dpvt = prec->dpvt;
+
+    ssize_t len = readAll(dpvt, true);
+    if (len < 0) {
+        return NULL;
+    }
+    if (len == 0) {
+        return fopen("/dev/null", "r");
+    }
+    return fmemopen(dpvt->sysfs->buf, len, "r");
+}
+
+// descriptor of the pseudo-file for TSE=-2 and TextFile:FRESHNESS
+int devTextFileSysfsFd(const TextFile_t *dpvt)
+{
+    return dpvt->sysfs->fd;
+}
+
+// bytes of buffers of the record, for devTextFileMemReport()
+size_t devTextFileSysfsMemory(const TextFile_t *dpvt)
+{
+    return sizeof(TextFileSysfs_t) + dpvt->sysfs->siz + 1;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Notifier thread: wait for POLLPRI/POLLERR raised by sysfs_notify() and
+// process the records watching the file
+//
+static void notifyThread(void *arg)
+{
+    struct pollfd *fds = NULL;
+    TextFileEntry_t **entries = NULL;
+    int nfds = 0;
+    char buf[SYSFS_BUFSIZ];
+
+    while (true) {
+        // copy the list, so that it can be changed while waiting
+        epicsMutexMustLock(watchLock);
+        fds = realloc(fds, (watchCount + 1) * sizeof(struct pollfd));
+        entries = realloc(entries, (watchCount + 1) * sizeof(TextFileEntry_t *));
+        if (fds == NULL || entries == NULL) {
+            cantProceed("realloc for sysfs notification failed");
+        }
+        fds[0].fd = watchPipe[0];
+        fds[0].events = POLLIN;
+        nfds = 1;
+        for (int i = 0; i < watchCount; i++) {
+            if (watchList[i].count > 0 && watchList[i].fd >= 0) {
+                fds[nfds].fd = watchList[i].fd;
+                fds[nfds].events = POLLPRI | POLLERR;
+                entries[nfds] = watchList[i].entry;
+                nfds ++;
+            }
+        }
+        epicsMutexUnlock(watchLock);
+
+        //
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno != EINTR) {
+                errlogPrintf("devTextFileSysfs: poll failed: %s\n", devTextFileStrerror(errno));
+                epicsThreadSleep(1.0);
+            }
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            ssize_t ret = read(watchPipe[0], buf, sizeof(buf));
+            (void)ret;
+        }
+
+        for (int i = 1; i < nfds; i++) {
+            if (fds[i].revents & (POLLPRI | POLLERR)) {
+                // reading from offset 0 again arms the next notification
+                ssize_t ret = pread(fds[i].fd, buf, sizeof(buf), 0);
+                (void)ret;
+                scanIoRequest(entries[i]->pollscan);
+            }
+        }
+    }
+}
+
+//
+static void watchInit(void *arg)
+{
+    watchLock = epicsMutexMustCreate();
+    if (pipe2(watchPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        cantProceed("pipe for sysfs notification failed");
+    }
+
+    epicsThreadMustCreate("devTextFileSysfs", epicsThreadPriorityMedium,
+                          epicsThreadGetStackSize(epicsThreadStackSmall),
+                          notifyThread, NULL);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Start or stop waiting for notification of the file, called from get_ioint_info
+// when the record enters or leaves I/O Intr scan
+//
+void devTextFileSysfsWatch(TextFile_t *dpvt, bool watch)
+{
+    TextFileEntry_t *entry = dpvt->entry;
+    watch_t *w = NULL;
+
+    epicsThreadOnce(&watchOnce, watchInit, NULL);
+
+    epicsMutexMustLock(watchLock);
+
+    for (int i = 0; i < watchCount; i++) {
+        if (watchList[i].entry == entry) {
+            w = &watchList[i];
+            break;
+        }
+    }
+
+    if (w == NULL) {
+        watch_t *list = realloc(watchList, (watchCount + 1) * sizeof(watch_t));
+        if (list == NULL) {
+            cantProceed("realloc for sysfs notification failed");
+        }
+        watchList = list;
+        w = &watchList[watchCount++];
+        w->entry = entry;
+        w->fd = -1;
+        w->count = 0;
+    }
+
+    // fd is kept open while not watched, as the notifier may be waiting for it
+    if (!watch) {
+        w->count --;
+    } else if (w->count++ == 0 && w->fd < 0) {
+        w->fd = open(entry->path, O_RDONLY | O_CLOEXEC);
+        if (w->fd < 0) {
+            errlogPrintf("%s (%s): can't open \"%s\" for notification: %s\n", dpvt->prec->name, __func__, entry->path, devTextFileStrerror(errno));
+        } else {
+            // notification is armed by reading
+            char buf[SYSFS_BUFSIZ];
+            ssize_t ret = pread(w->fd, buf, sizeof(buf), 0);
+            (void)ret;
+        }
+    }
+
+    epicsMutexUnlock(watchLock);
+
+    //
+    ssize_t ret = write(watchPipe[1], "", 1);
+    (void)ret;
+}
+
+// end
@@ -0,0 +1,214 @@
+// -*- coding: utf-8; mode: c; c-basic-offiset: 4 -*-
+
+//////////////////////////////////////////////////////////////////////////
+//
+// Copyright (c) 2020 High Energy Accelerator Research Organization (KEK)
+//
+// text file Device Support 0.0.0
+// and higher are distributed subject to a Software License Agreement found
+// in file LICENSE that is included with this distribution.
+//
+// Author: Shuei Yamada (shuei@post.kek.jp)
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+
+//
+#include "cantProceed.h"
+#include "dbAccess.h"
+#include "dbCommon.h"
+#include "errlog.h"
+#include "epicsAtomic.h"
+#include "epicsMutex.h"
+#include "epicsThread.h"
+#include "epicsExport.h"
+#include "iocsh.h"
+
+//
+#include "devTextFile.h"
+
+// record begin/end of each stage when non-zero, checked by TRACE_BEGIN/TRACE_END
+int devTextFileTrace = 0;
+
+// number of events kept per thread, the oldest are overwritten
+static int devTextFileTraceSize = 65536;
+
+//
+typedef struct {
+    uint64_t     ts;        // CLOCK_MONOTONIC in nanoseconds
+    const char  *name;      // record name, which lives as long as the IOC
+    uint8_t      stage;
+    char         phase;     // 'B' or 'E'
+} event_t;
+
+// ring buffer written only by its own thread
+typedef struct ring {
+    struct ring *next;
+    char         thread[32];
+    int          tid;
+    size_t       size;
+    size_t       count;     // total number of events written, read by the dumper
+    event_t     *events;
+} ring_t;
+
+//
+static const char *stageNames[] = {
+    "read",
+    "open",
+    "parse",
+    "convert",
+    "errlog",
+    "write",
+    "close",
+};
+
+static ring_t *ringList = NULL; // guarded by ringLock
+static int ringCount = 0;
+static epicsMutexId ringLock = NULL;
+static epicsThreadPrivateId ringKey = NULL;
+static epicsThreadOnceId ringOnce = EPICS_THREAD_ONCE_INIT;
+
+//
+static void ringInit(void *arg)
+{
+    ringLock = epicsMutexMustCreate();
+    ringKey = epicsThreadPrivateCreate();
+}
+
+// ring of this thread, created on the first event
+static ring_t *ringSelf(void)
+{
+    epicsThreadOnce(&ringOnce, ringInit, NULL);
+
+    ring_t *ring = epicsThreadPrivateGet(ringKey);
+    if (ring) {
+        return ring;
+    }
+
+    ring = devTextFileCalloc(1, sizeof(ring_t), "calloc for trace ring failed");
+    ring->size = (devTextFileTraceSize > 0) ? devTextFileTraceSize : 65536;
+    ring->events = devTextFileCalloc(ring->size, sizeof(event_t), "calloc for trace events failed");
+    snprintf(ring->thread, sizeof(ring->thread), "%s", epicsThreadGetNameSelf());
+
+    epicsMutexMustLock(ringLock);
+    ring->tid = ++ringCount;
+    ring->next = ringList;
+    ringList = ring;
+    epicsMutexUnlock(ringLock);
+
+    epicsThreadPrivateSet(ringKey, ring);
+
+    return ring;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Record an event, called only when tracing is enabled
+//
+void devTextFileTraceEvent(const dbCommon *prec, trace_t stage, char phase)
+{
+    ring_t *ring = ringSelf();
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    const size_t count = ring->count;
+    event_t *ev = &ring->events[count % ring->size];
+    ev->ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    ev->name = prec->name;
+    ev->stage = stage;
+    ev->phase = phase;
+
+    // publish the event after it has been written
+    epicsAtomicSetSizeT(&ring->count, count + 1);
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// Write events of all threads to a file in Chrome trace event format, which
+// can be loaded by chrome://tracing or Perfetto. Events written while dumping
+// may be inconsistent.
+//
+long devTextFileTraceDump(const char *filename)
+{
+    if (filename == NULL || filename[0] == 0) {
+        printf("usage: devTextFileTraceDump filename\n");
+        return -1;
+    }
+
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+        errlogPrintf("devTextFileTraceDump: can't open \"%s\" for writing: %s\n", filename, devTextFileStrerror(errno));
+        return -1;
+    }
+
+    epicsThreadOnce(&ringOnce, ringInit, NULL);
+
+    epicsMutexMustLock(ringLock);
+    ring_t *list = ringList;
+    epicsMutexUnlock(ringLock);
+
+    //
+    size_t nevents = 0;
+    const char *sep = "";
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (ring_t *ring = list; ring; ring = ring->next) {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", sep, ring->tid, ring->thread);
+        sep = ",\n";
+
+        const size_t count = epicsAtomicGetSizeT(&ring->count);
+        const size_t first = (count > ring->size) ? count - ring->size : 0;
+        for (size_t i = first; i < count; i++) {
+            const event_t *ev = &ring->events[i % ring->size];
+            fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"devTextFile\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"record\":\"%s\"}}",
+                    sep, stageNames[ev->stage], ev->phase, ev->ts / 1000.0, ring->tid, ev->name);
+            nevents ++;
+        }
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    //
+    if (fclose(fp) != 0) {
+        errlogPrintf("devTextFileTraceDump: can't write \"%s\": %s\n", filename, devTextFileStrerror(errno));
+        return -1;
+    }
+
+    printf("%zu event(s) written to \"%s\"\n", nevents, filename);
+
+    //
+    return 0;
+}
+
+/////////////////////////////////////////////////////////////////
+//
+// iocsh command
+//
+static const iocshArg traceDumpArg0 = { "filename", iocshArgString };
+static const iocshArg * const traceDumpArgs[] = { &traceDumpArg0 };
+static const iocshFuncDef traceDumpDef = { "devTextFileTraceDump", 1, traceDumpArgs };
+
+static void traceDumpCall(const iocshArgBuf *args)
+{
+    devTextFileTraceDump(args[0].sval);
+}
+
+static void devTextFileTraceRegister(void)
+{
+    iocshRegister(&traceDumpDef, traceDumpCall);
+}
+
+// Register symbol(s) used by IOC core
+epicsExportAddress(int, devTextFileTrace);
+epicsExportAddress(int, devTextFileTraceSize);
+epicsExportRegistrar(devTextFileTraceRegister);
+
+// end
@@ -46,8 +46,10 @@ static int devTextFileWfDebug = 0;
 /***************************************************************
  * waveform (command/response IO)
  ***************************************************************/
+static long report(int);
 static long init(void);
 static long init_record(struct waveformRecord *);
+static long get_ioint_info(int, struct dbCommon *, IOSCANPVT *);
 static long read_wf(struct waveformRecord *);
 
 struct {
@@ -60,16 +62,22 @@ struct {
     DEVSUPFUN   special_linconv;
 } devTextFileWf = {
     6,
-    NULL,
+    report,
     init,
     init_record,
-    NULL,
+    get_ioint_info,
     read_wf,
     NULL
 };
 
 epicsExportAddress(dset, devTextFileWf);
 
+//
+static long report(int level)
+{
+    return devTextFileReport(level, &devTextFileWf);
+}
+
 //
 static long init(void)
 {
@@ -111,7 +119,7 @@ static long init_record(struct waveformRecord *prec)
     }
 
     // Allocate private data storage area
-    TextFile_t *dpvt = callocMustSucceed(1, sizeof(TextFile_t), "calloc for private_t failed ");
+    TextFile_t *dpvt = devTextFileAlloc();
     prec->dpvt = dpvt;
 
     // Extract input filename
@@ -123,20 +131,54 @@ static long init_record(struct waveformRecord *prec)
         pstr++;
     }
 
-    const size_t fsize = strlen(pstr) + 1;
-    //if (fsize > MAX_INSTIO_STRING) {
-    //    errlogPrintf("%s (devTextFileWf): INP field is too long\n", prec->name);
-    //    return -1;
-    //}
-    dpvt->name = callocMustSucceed(1, fsize, "calloc for filename failed");
-    strcpy(dpvt->name, pstr);
+    // records referring to the same file share the name
+    dpvt->name = devTextFileIntern(pstr);
+
+    // Configure options from info tags
+    if (devTextFileConfig((dbCommon *)prec, dpvt) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
+
+    // files matching pattern in INP, e.g. "@/data/ch*.txt"
+    if (devTextFileGlobInit((dbCommon *)prec, dpvt) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
+
+    // values pushed through FIFO or socket, see TextFile:STREAM
+    if (dpvt->stream && devTextFileStreamStart((dbCommon *)prec, prec->ftvl, prec->nelm) < 0) {
+        prec->pact = 1;
+        return -1;
+    }
+
+    // min/max envelope needs at least one pair
+    if (dpvt->decimate == kDecimMinMax && prec->nelm < 2) {
+        errlogPrintf("%s (devTextFileWf): NELM must be 2 or more for minmax decimation\n", prec->name);
+        prec->pact = 1;
+        return -1;
+    }
+
+    // Statistics are published to companion records, if any.
+    // With ASLO/AOFF/SMOO they are taken over the converted values instead.
+    dpvt->dostats = !dpvt->linconv;
+
+    // Allocate storage for smoothing
+    if (dpvt->linconv && dpvt->smoo != 0.0) {
+        devTextFileSmoothInit(dpvt, prec->nelm);
+    }
 
     //
     if (dpvt->flag == kRead) {
         const char *filename = pstr;
 
         //
-        long ret = devTextFileRead(filename, prec->bptr, (dbCommon *)prec, prec->ftvl, prec->nelm, devTextFileWfDebug);
+        long ret;
+        if (dpvt->glob) {
+            ret = devTextFileGlobRead((dbCommon *)prec, prec->bptr, prec->ftvl, prec->nelm, devTextFileWfDebug);
+        } else {
+            ret = devTextFileRead(filename, prec->bptr, (dbCommon *)prec, prec->ftvl, prec->nelm, devTextFileWfDebug);
+        }
 
         //
         if (ret < 0) {
@@ -144,6 +186,16 @@ static long init_record(struct waveformRecord *prec)
             return -1;
         }
 
+        // Apply ASLO/AOFF/SMOO
+        if (dpvt->linconv) {
+            devTextFileConvert(dpvt, prec->bptr, prec->ftvl, ret, (dpvt->entry->nstats > 0) ? &dpvt->stats : NULL);
+        }
+
+        // Publish statistics to companion records
+        if (dpvt->entry->nstats > 0) {
+            devTextFileStatsPublish(dpvt);
+        }
+
         //
         prec->nord = ret;
     }
@@ -152,6 +204,29 @@ static long init_record(struct waveformRecord *prec)
     return 0;
 }
 
+//
+static long get_ioint_info(int cmd, struct dbCommon *prec, IOSCANPVT *ppvt)
+{
+    TextFile_t *dpvt = prec->dpvt;
+
+    //
+    *ppvt = dpvt->ioscanpvt;
+
+    // poll the file while the record is scanned by I/O Intr
+    if (dpvt->poll) {
+        devTextFilePollWatch(dpvt, cmd == 0);
+    }
+    if (dpvt->sysfs) {
+        devTextFileSysfsWatch(dpvt, cmd == 0);
+    }
+    if (dpvt->shm) {
+        devTextFileShmWatch(dpvt, cmd == 0);
+    }
+
+    //
+    return 0;
+}
+
 //
 static long read_wf(struct waveformRecord *prec)
 {
@@ -165,7 +240,12 @@ static long read_wf(struct waveformRecord *prec)
     }
 
     //
-    long ret = devTextFileRead(filename, prec->bptr, (dbCommon *)prec, prec->ftvl, prec->nelm, devTextFileWfDebug);
+    long ret;
+    if (dpvt->glob) {
+        ret = devTextFileGlobRead((dbCommon *)prec, prec->bptr, prec->ftvl, prec->nelm, devTextFileWfDebug);
+    } else {
+        ret = devTextFileRead(filename, prec->bptr, (dbCommon *)prec, prec->ftvl, prec->nelm, devTextFileWfDebug);
+    }
 
     //
     if (ret < 0) {
@@ -173,6 +253,18 @@ static long read_wf(struct waveformRecord *prec)
         return -1;
     }
 
+    // Apply ASLO/AOFF/SMOO
+    if (dpvt->linconv) {
+        TRACE_BEGIN(prec, kTraceConvert);
+        devTextFileConvert(dpvt, prec->bptr, prec->ftvl, ret, (dpvt->entry->nstats > 0) ? &dpvt->stats : NULL);
+        TRACE_END(prec, kTraceConvert);
+    }
+
+    // Publish statistics to companion records
+    if (dpvt->entry->nstats > 0) {
+        devTextFileStatsPublish(dpvt);
+    }
+
     //
     prec->nord = ret;
 